@@ -0,0 +1,48 @@
+// Cost of reading component members from Lua, through the interned member lookup of ComponentHandler.
+//  The component has 30 members with names longer than the std::string small buffer.
+//  Build with -DSP_BENCHMARKS=ON and run sp_bench_lua_members from a release build.
+#include "script/component.h"
+#include "script/environment.h"
+#include "ecs/entity.h"
+
+#include <chrono>
+#include <cstdio>
+
+
+struct BenchmarkComponent
+{
+    float x = 0.0f;
+    float y = 0.0f;
+};
+
+static constexpr int iterations = 2000000;
+
+int main()
+{
+    using Handler = sp::script::ComponentHandler<BenchmarkComponent>;
+    Handler::name("benchmark");
+    Handler::members["x"] = {
+        [](lua_State* L, const void* ptr) { lua_pushnumber(L, static_cast<const BenchmarkComponent*>(ptr)->x); return 1; },
+        [](lua_State* L, void* ptr) { static_cast<BenchmarkComponent*>(ptr)->x = static_cast<float>(lua_tonumber(L, -1)); }};
+    Handler::members["y"] = {
+        [](lua_State* L, const void* ptr) { lua_pushnumber(L, static_cast<const BenchmarkComponent*>(ptr)->y); return 1; },
+        [](lua_State* L, void* ptr) { static_cast<BenchmarkComponent*>(ptr)->y = static_cast<float>(lua_tonumber(L, -1)); }};
+    for(int n=0; n<28; n++)
+        Handler::members["a_longer_member_name_" + std::to_string(n)] = Handler::members["x"];
+
+    sp::script::Environment env;
+    auto entity = sp::ecs::Entity::create();
+    entity.addComponent<BenchmarkComponent>().y = 1.0f;
+    env.setGlobal("entity", entity);
+
+    auto start = std::chrono::steady_clock::now();
+    auto result = env.run<void>("local c = entity.components.benchmark local s = 0 for i=1," + std::to_string(iterations) + " do s = s + c.a_longer_member_name_7 + c.y end c.x = s");
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (result.isErr())
+    {
+        printf("Error: %s\n", result.error().c_str());
+        return 1;
+    }
+    printf("two member reads: %.1f ns/iteration  (%f)\n", seconds * 1e9 / iterations, entity.getComponent<BenchmarkComponent>()->x);
+    return 0;
+}
@@ -0,0 +1,126 @@
+// Checks the resolver cache and the non-blocking connect of TcpSocket against a TcpListener on this machine.
+//  Resolves localhost through Address::resolve, connects to the listener over ::1 and 127.0.0.1, and checks that
+//  failed lookups are cached for a short time only. Takes about 6 seconds, as it waits for the failed lookup to expire.
+//  Build with -DSP_BENCHMARKS=ON and run sp_bench_network_connect, it returns non-zero when a check fails.
+#include "io/network/address.h"
+#include "io/network/tcpListener.h"
+#include "io/network/tcpSocket.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+
+using sp::io::network::Address;
+using sp::io::network::StreamSocket;
+using sp::io::network::TcpListener;
+using sp::io::network::TcpSocket;
+using Clock = std::chrono::steady_clock;
+
+static constexpr int port = 38491;
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+static double millisecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// A cached result hands out the same shared state, so get() returns the same object.
+static bool isSameLookup(const std::shared_future<Address>& a, const std::shared_future<Address>& b)
+{
+    return &a.get() == &b.get();
+}
+
+// Connect without blocking, and poll the socket like a game loop would till it is connected or failed.
+static StreamSocket::State connectAndWait(TcpSocket& socket, const Address& address, int target_port, double& milliseconds)
+{
+    auto start = Clock::now();
+    socket.setBlocking(false);
+    socket.connect(address, target_port);
+    auto state = socket.getState();
+    while(state == StreamSocket::State::Connecting && millisecondsSince(start) < 5000.0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        state = socket.getState();
+    }
+    milliseconds = millisecondsSince(start);
+    return state;
+}
+
+static bool acceptOne(TcpListener& listener)
+{
+    TcpSocket accepted;
+    auto start = Clock::now();
+    while(millisecondsSince(start) < 1000.0)
+    {
+        if (listener.accept(accepted))
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+int main()
+{
+    TcpListener listener;
+    if (!listener.listen(port))
+    {
+        printf("Cannot listen on port %d\n", port);
+        return 1;
+    }
+    listener.setBlocking(false);
+
+    auto start = Clock::now();
+    auto localhost_future = Address::resolve("localhost");
+    localhost_future.wait();
+    printf("localhost resolved in %.3f ms:", millisecondsSince(start));
+    for(auto& name : localhost_future.get().getHumanReadable())
+        printf(" %s", name.c_str());
+    printf("\n");
+    check(!localhost_future.get().getHumanReadable().empty(), "localhost resolves");
+    start = Clock::now();
+    auto cached_future = Address::resolve("localhost");
+    check(isSameLookup(cached_future, localhost_future), "second resolve of localhost is served from the cache");
+    printf("     cached resolve took %.3f ms\n", millisecondsSince(start));
+
+    double milliseconds;
+    for(auto name : {"::1", "127.0.0.1"})
+    {
+        TcpSocket socket;
+        auto state = connectAndWait(socket, Address(name), port, milliseconds);
+        printf("     %s connected in %.3f ms\n", name, milliseconds);
+        check(state == StreamSocket::State::Connected && acceptOne(listener), name);
+    }
+    {
+        TcpSocket socket;
+        auto state = connectAndWait(socket, localhost_future.get(), port, milliseconds);
+        printf("     localhost connected in %.3f ms\n", milliseconds);
+        check(state == StreamSocket::State::Connected && acceptOne(listener), "localhost, IPv6 and IPv4 addresses interleaved");
+    }
+    {
+        // Nothing listens here, each refused address moves on to the next one without waiting for the attempt delay.
+        TcpSocket socket;
+        auto state = connectAndWait(socket, localhost_future.get(), port + 1, milliseconds);
+        printf("     refused after %.3f ms\n", milliseconds);
+        check(state == StreamSocket::State::Closed && milliseconds < 250.0, "refused addresses fail over without delay");
+    }
+
+    // Failed lookups are cached for a few seconds, so a game that retries every frame does not flood DNS.
+    auto failed_future = Address::resolve("sp-network-check.invalid");
+    failed_future.wait();
+    check(failed_future.get().getHumanReadable().empty(), "invalid name does not resolve");
+    check(isSameLookup(Address::resolve("sp-network-check.invalid"), failed_future), "failed lookup is cached");
+    std::this_thread::sleep_for(std::chrono::seconds(6));
+    check(!isSameLookup(Address::resolve("sp-network-check.invalid"), failed_future), "failed lookup expires and is looked up again");
+
+    listener.close();
+    printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
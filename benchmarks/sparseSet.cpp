@@ -0,0 +1,91 @@
+// Lookup cost of SparseSet and Bitset with their paged sparse arrays, next to a flat sparse vector like SparseSet used before.
+//  Build with -DSP_BENCHMARKS=ON and run sp_bench_sparseset from a release build.
+#include "container/sparseset.h"
+#include "container/bitset.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+
+static constexpr uint32_t key_range = 400000;
+static constexpr size_t key_count = 20000;
+static constexpr size_t lookup_count = 20000000;
+// Power of two, so picking the next key is a mask instead of a division.
+static constexpr size_t lookup_table_size = 1 << 16;
+
+// The sparse to dense mapping as SparseSet had it before paging, for comparison.
+class FlatSparseSet
+{
+public:
+    bool has(uint32_t index) { return index < sparse.size() && sparse[index] < dense.size(); }
+    int& get(uint32_t index) { return data[sparse[index]]; }
+    void set(uint32_t index, int value)
+    {
+        if (index >= sparse.size())
+            sparse.resize(index + 1, std::numeric_limits<uint32_t>::max());
+        sparse[index] = static_cast<uint32_t>(dense.size());
+        dense.push_back(index);
+        data.push_back(value);
+    }
+private:
+    std::vector<uint32_t> sparse;
+    std::vector<uint32_t> dense;
+    std::vector<int> data;
+};
+
+template<typename FUNC> static void measure(const char* name, const std::vector<uint32_t>& lookups, FUNC func)
+{
+    size_t result = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(size_t n=0; n<lookup_count; n++)
+        result += func(lookups[n & (lookup_table_size - 1)]);
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // Print the result, so the compiler cannot drop the loop.
+    printf("%-22s %6.2f ns/lookup  (%zu)\n", name, seconds * 1e9 / double(lookup_count), result);
+}
+
+int main()
+{
+    std::mt19937 random(1234);
+    std::uniform_int_distribution<uint32_t> key_distribution(0, key_range - 1);
+    std::vector<uint32_t> keys;
+    for(size_t n=0; n<key_count; n++)
+        keys.push_back(key_distribution(random));
+
+    sp::SparseSet<int> sparse_set;
+    sp::Bitset bitset;
+    FlatSparseSet flat_set;
+    for(auto key : keys)
+    {
+        sparse_set.set(key, int(key));
+        bitset.set(key);
+        if (!flat_set.has(key))
+            flat_set.set(key, int(key));
+    }
+
+    // For has(), half of the lookups hit and half are random keys that mostly miss. get() only looks up keys that exist.
+    std::vector<uint32_t> lookups;
+    std::vector<uint32_t> hits;
+    for(size_t n=0; n<lookup_table_size; n++)
+    {
+        lookups.push_back(n % 2 ? keys[n % keys.size()] : key_distribution(random));
+        hits.push_back(keys[n % keys.size()]);
+    }
+
+    measure("SparseSet::has", lookups, [&](uint32_t key) { return sparse_set.has(key) ? 1 : 0; });
+    measure("flat has", lookups, [&](uint32_t key) { return flat_set.has(key) ? 1 : 0; });
+    measure("SparseSet::get", hits, [&](uint32_t key) { return sparse_set.get(key); });
+    measure("flat get", hits, [&](uint32_t key) { return flat_set.get(key); });
+    measure("Bitset::has", lookups, [&](uint32_t key) { return bitset.has(key) ? 1 : 0; });
+
+    // Walking the dense storage like a Query does, reading each entry through get() or straight from its dense position.
+    auto& dense = sparse_set.denseIndices();
+    std::vector<uint32_t> positions;
+    for(size_t n=0; n<lookup_table_size; n++)
+        positions.push_back(static_cast<uint32_t>(n % dense.size()));
+    measure("walk with get", positions, [&](uint32_t position) { return sparse_set.get(dense[position]); });
+    measure("walk with getDense", positions, [&](uint32_t position) { return sparse_set.getDense(position); });
+    return 0;
+}
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <stdint.h>
-#include <vector>
+#include "pagedarray.h"
 
 
 namespace sp {
@@ -11,23 +11,19 @@ class Bitset final
 public:
     bool has(uint32_t index)
     {
-        auto idx = storageIndex(index);
-        if (idx >= storage.size()) return false;
-        return storage[idx] & storageMask(index);
+        return storage.get(storageIndex(index)) & storageMask(index);
     }
 
     void set(uint32_t index)
     {
         auto idx = storageIndex(index);
-        if (idx >= storage.size()) storage.resize(idx + 1, 0);
-        storage[idx] |= storageMask(index);
+        storage.set(idx, storage.get(idx) | storageMask(index));
     }
 
     void reset(uint32_t index)
     {
         auto idx = storageIndex(index);
-        if (idx >= storage.size()) return;
-        storage[idx] &=~storageMask(index);
+        storage.set(idx, storage.get(idx) & ~storageMask(index));
     }
 
     void clear(uint32_t index)
@@ -39,7 +35,7 @@ private:
     size_t storageIndex(uint32_t index) { return index / (8 * sizeof(StorageType));}
     StorageType storageMask(uint32_t index) { return 1 << (index % (8 * sizeof(StorageType)));}
 
-    std::vector<StorageType> storage;
+    PagedArray<StorageType, 0> storage;
 };
 
 }
\ No newline at end of file
@@ -11,6 +11,18 @@ namespace sp {
 template<typename T, size_t CHUNK_SIZE=128> class ChunkedVector final
 {
 public:
+    static constexpr size_t chunk_size = CHUNK_SIZE;
+
+    ChunkedVector() = default;
+    ChunkedVector(const ChunkedVector&) = delete;
+    ChunkedVector& operator=(const ChunkedVector&) = delete;
+    ~ChunkedVector() {
+        while(count > 0)
+            pop_back();
+        for(auto chunk : chunks)
+            delete chunk;
+    }
+
     size_t size() {
         return count;
     }
@@ -26,6 +38,14 @@ public:
         count -= 1;
         (&(*this)[count])->~T();
     }
+    // Release chunks that are no longer used after pop_back()
+    void shrink_to_fit() {
+        auto used_chunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        while(chunks.size() > used_chunks) {
+            delete chunks.back();
+            chunks.pop_back();
+        }
+    }
 
     T& operator[](size_t index) {
         auto& chunk = chunks[index / CHUNK_SIZE];
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <array>
+#include <vector>
+
+
+namespace sp {
+
+// An array indexed by integers, where most entries have the EMPTY value.
+//	Memory is allocated in fixed size pages, only for pages that contain a non-empty entry.
+//	Pages without entries point to a shared page that only contains EMPTY values, so reading needs no check for missing pages.
+template<typename T, T EMPTY, size_t PAGE_SIZE=1024> class PagedArray final
+{
+public:
+    PagedArray() = default;
+    PagedArray(const PagedArray&) = delete;
+    PagedArray& operator=(const PagedArray&) = delete;
+    ~PagedArray() { clear(); }
+
+    T get(uint32_t index) const
+    {
+        auto page = index / PAGE_SIZE;
+        if (page >= pages.size())
+            return EMPTY;
+        return pages[page][index % PAGE_SIZE];
+    }
+
+    void set(uint32_t index, T value)
+    {
+        auto page = index / PAGE_SIZE;
+        if (page >= pages.size()) {
+            if (value == EMPTY)
+                return;
+            pages.resize(page + 1, emptyPage());
+            page_usage.resize(page + 1, 0);
+        }
+        auto& entry = pages[page][index % PAGE_SIZE];
+        if (entry == EMPTY) {
+            if (value == EMPTY)
+                return;
+            if (pages[page] == emptyPage()) {
+                pages[page] = new T[PAGE_SIZE];
+                std::fill(pages[page], pages[page] + PAGE_SIZE, EMPTY);
+            }
+            page_usage[page]++;
+            pages[page][index % PAGE_SIZE] = value;
+        } else if (value == EMPTY) {
+            entry = EMPTY;
+            if (--page_usage[page] == 0) {
+                delete[] pages[page];
+                pages[page] = emptyPage();
+            }
+        } else {
+            entry = value;
+        }
+    }
+
+    void clear()
+    {
+        for(auto page : pages)
+            if (page != emptyPage())
+                delete[] page;
+        pages.clear();
+        page_usage.clear();
+    }
+
+    // Amount of pages that have memory allocated.
+    size_t allocatedPages() const
+    {
+        size_t result = 0;
+        for(auto page : pages)
+            if (page != emptyPage())
+                result++;
+        return result;
+    }
+private:
+    static constexpr std::array<T, PAGE_SIZE> makeEmptyPage()
+    {
+        std::array<T, PAGE_SIZE> page{};
+        for(size_t n=0; n<PAGE_SIZE; n++)
+            page[n] = EMPTY;
+        return page;
+    }
+    // Never written to, set() allocates a real page before writing.
+    static T* emptyPage() { return const_cast<T*>(empty_page.data()); }
+    static constexpr std::array<T, PAGE_SIZE> empty_page = makeEmptyPage();
+
+    std::vector<T*> pages;
+    std::vector<uint32_t> page_usage;
+};
+
+}
@@ -4,46 +4,46 @@
 #include <vector>
 #include <limits>
 #include "chunkedvector.h"
+#include "pagedarray.h"
 
 
 namespace sp {
 
 // A sparseset is a more optimized version of a map<> with an important constrain:
-//	The key has to be an integer type with a limited range, the smaller the better.
+//	The key has to be an integer type. The key to dense index lookup is paged, so memory scales with the keys in use, not with the highest key.
 //	This gives optimized cache performance when iterating over all entities, but still allows quick lookup of individual entries.
+//	Removing an entry destroys it right away, but leaves a free slot so iteration stays valid.
+//	compact() closes those free slots at a point where nothing is iterating.
 template<typename T> class SparseSet final
 {
 public:
     bool has(uint32_t index)
     {
-        if (index >= sparse.size())
-            return false;
-        return sparse[index] < dense.size();
+        return sparse.get(index) < dense.size();
     }
     
     T& get(uint32_t index)
     {
-        return data[sparse[index]];
+        return data[sparse.get(index)];
     }
 
     bool set(uint32_t index, const T& value)
     {
         if (has(index)) {
-            data[sparse[index]] = value;
+            data[sparse.get(index)] = value;
             return false;
         }
-        if (sparse.size() <= index)
-            sparse.resize(index + 1, std::numeric_limits<uint32_t>::max());
         if (free_dense != no_free_dense) {
             // Reuse a free slot
             auto new_free = dense[free_dense] & ~free_mark;
-            sparse[index] = free_dense;
+            sparse.set(index, free_dense);
             dense[free_dense] = index;
             data[free_dense] = value;
             free_dense = new_free;
+            free_count--;
         } else {
             // Append to the data
-            sparse[index] = static_cast<uint32_t>(dense.size());
+            sparse.set(index, static_cast<uint32_t>(dense.size()));
             dense.push_back(index);
             data.emplace_back(value);
         }
@@ -53,21 +53,20 @@ public:
     bool set(uint32_t index, T&& value)
     {
         if (has(index)) {
-            data[sparse[index]] = std::move(value);
+            data[sparse.get(index)] = std::move(value);
             return false;
         }
-        if (sparse.size() <= index)
-            sparse.resize(index + 1, std::numeric_limits<uint32_t>::max());
         if (free_dense != no_free_dense) {
             // Reuse a free slot
             auto new_free = dense[free_dense] & ~free_mark;
-            sparse[index] = free_dense;
+            sparse.set(index, free_dense);
             dense[free_dense] = index;
             data[free_dense] = std::move(value);
             free_dense = new_free;
+            free_count--;
         } else {
             // Append to the data
-            sparse[index] = static_cast<uint32_t>(dense.size());
+            sparse.set(index, static_cast<uint32_t>(dense.size()));
             dense.push_back(index);
             data.emplace_back(std::move(value));
         }
@@ -78,12 +77,42 @@ public:
     {
         if (!has(index))
             return false;
-        auto new_free = sparse[index];
-        sparse[index] = free_mark;
+        auto new_free = sparse.get(index);
+        sparse.set(index, empty);
         dense[new_free] = free_dense | free_mark;
         free_dense = new_free;
+        free_count++;
+        // Free slots hold a default constructed value, so anything the removed value owned is released now.
+        auto ptr = &data[new_free];
+        ptr->~T();
+        new (ptr) T();
         return true;
     }
+
+    // Move all entries down into the free slots, keeping their order, so iteration no longer needs to skip anything.
+    //  Invalidates references to entries, so only call this when nothing is iterating or holding on to entries.
+    void compact()
+    {
+        if (free_count == 0)
+            return;
+        size_t write = 0;
+        for(size_t read = 0; read < dense.size(); read++) {
+            if (dense[read] & free_mark)
+                continue;
+            if (read != write) {
+                data[write] = std::move(data[read]);
+                dense[write] = dense[read];
+                sparse.set(dense[write], static_cast<uint32_t>(write));
+            }
+            write++;
+        }
+        dense.resize(write);
+        while(data.size() > write)
+            data.pop_back();
+        data.shrink_to_fit();
+        free_dense = no_free_dense;
+        free_count = 0;
+    }
     
     class Iterator
     {
@@ -110,15 +139,26 @@ public:
     
     Iterator begin() { return Iterator(*this, 0); }
     Iterator end() { return Iterator(*this, dense.size()); }
+    // Entity index of each entry in the dense storage, free slots have the free_mark set.
+    //  Used by queries that iterate one storage while looking up others.
+    const std::vector<uint32_t>& denseIndices() const { return dense; }
+    // Entry at a position in the dense storage, which skips the sparse lookup of get() for code that walks denseIndices().
+    T& getDense(size_t dense_index) { return data[dense_index]; }
 
     size_t size() { return data.size(); }
+    // Amount of free slots left by remove(), that compact() can close.
+    size_t freeCount() { return free_count; }
+    // Entries in the dense storage are stored in chunks of this size, ranges aligned to this do not share memory.
+    static constexpr size_t chunk_size = ChunkedVector<T>::chunk_size;
+    static constexpr uint32_t free_mark = 0x80000000;
 private:
-    std::vector<uint32_t> sparse;
+    static constexpr uint32_t empty = std::numeric_limits<uint32_t>::max();
+    PagedArray<uint32_t, empty> sparse;
     std::vector<uint32_t> dense;
     ChunkedVector<T> data;
-    static constexpr uint32_t free_mark = 0x80000000;
     static constexpr uint32_t no_free_dense = std::numeric_limits<uint32_t>::max() & ~free_mark;
     uint32_t free_dense = no_free_dense;
+    size_t free_count = 0;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include "ecs/commandBuffer.h"
+
+
+namespace sp::ecs {
+
+CommandBuffer::PendingEntity CommandBuffer::create()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return {create_count++};
+}
+
+void CommandBuffer::destroy(Entity entity)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    destroy_list.push_back(entity);
+}
+
+std::vector<Entity> CommandBuffer::playback()
+{
+    // Take the recorded commands out first, so destructors and the pre destroy callback can record new commands.
+    uint32_t count;
+    std::vector<Entity> destroy;
+    std::vector<std::unique_ptr<QueueBase>> component_queues;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        count = create_count;
+        create_count = 0;
+        destroy.swap(destroy_list);
+        component_queues.swap(queues);
+    }
+
+    std::vector<Entity> created;
+    created.reserve(count);
+    for(uint32_t n=0; n<count; n++)
+        created.push_back(Entity::create());
+
+    for(auto& queue : component_queues)
+        if (queue)
+            queue->playback(created);
+
+    for(auto entity : destroy)
+        entity.destroy();
+    return created;
+}
+
+bool CommandBuffer::empty()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (create_count > 0 || !destroy_list.empty())
+        return false;
+    for(auto& queue : queues)
+        if (queue && !queue->empty())
+            return false;
+    return true;
+}
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include "ecs/entity.h"
+
+
+namespace sp::ecs {
+
+// Records structural changes (creating and destroying entities, adding and removing components) to apply them later in one batch.
+//  Recording is thread safe, so this can be used from systems running on worker threads and from Query::parallel_for_each.
+//  playback() has to be called from the main thread, while nothing is iterating over components.
+//  Playback creates entities first, then applies component changes grouped per component type, and destroys entities last.
+class CommandBuffer {
+public:
+    // Entity that will be created on playback. Components can be added to it before it exists.
+    class PendingEntity {
+    public:
+        uint32_t id;
+    };
+
+    PendingEntity create();
+    void destroy(Entity entity);
+
+    template<typename T> void addComponent(Entity entity, T value) { record<T>({entity, no_pending}, std::move(value)); }
+    template<typename T> void addComponent(PendingEntity entity, T value) { record<T>({{}, entity.id}, std::move(value)); }
+    template<typename T> void removeComponent(Entity entity) { record<T>({entity, no_pending}, std::nullopt); }
+
+    // Apply all recorded changes and clear the buffer. Returns the entities that were created, in the order create() was called.
+    std::vector<Entity> playback();
+    bool empty();
+private:
+    static constexpr uint32_t no_pending = std::numeric_limits<uint32_t>::max();
+    struct Target {
+        Entity entity;
+        uint32_t pending;
+    };
+
+    class QueueBase {
+    public:
+        virtual ~QueueBase() = default;
+        virtual void playback(const std::vector<Entity>& created) = 0;
+        virtual bool empty() = 0;
+    };
+    template<typename T> class Queue : public QueueBase {
+    public:
+        // A value to add, or nullopt to remove the component. Kept in one list so the recorded order is kept.
+        std::vector<std::pair<Target, std::optional<T>>> commands;
+
+        void playback(const std::vector<Entity>& created) override {
+            for(auto& [target, value] : commands) {
+                Entity entity = target.pending == no_pending ? target.entity : created[target.pending];
+                if (!entity)
+                    continue;
+                if (value)
+                    entity.addComponent<T>(std::move(*value));
+                else
+                    entity.removeComponent<T>();
+            }
+            commands.clear();
+        }
+        bool empty() override { return commands.empty(); }
+    };
+
+    template<typename T> void record(Target target, std::optional<T>&& value) {
+        auto type_id = ComponentStorage<T>::storage.getTypeId();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (type_id >= queues.size())
+            queues.resize(type_id + 1);
+        if (!queues[type_id])
+            queues[type_id] = std::make_unique<Queue<T>>();
+        static_cast<Queue<T>*>(queues[type_id].get())->commands.emplace_back(target, std::move(value));
+    }
+
+    std::mutex mutex;
+    uint32_t create_count = 0;
+    std::vector<Entity> destroy_list;
+    std::vector<std::unique_ptr<QueueBase>> queues;   // Indexed on component type id, so playback is in type order.
+};
+
+}
@@ -1,19 +1,41 @@
 #include "ecs/component.h"
+#include <vector>
 
 namespace sp::ecs {
 
 static ComponentStorageBase* all_component_storage = nullptr;
 
+// Function local, as component storages are created during static initialization.
+static std::vector<ComponentStorageBase*>& storageByTypeId()
+{
+    static std::vector<ComponentStorageBase*> list;
+    return list;
+}
+
 ComponentStorageBase::ComponentStorageBase()
 {
     this->next = all_component_storage;
     all_component_storage = this;
+    type_id = static_cast<uint32_t>(storageByTypeId().size());
+    storageByTypeId().push_back(this);
+}
+
+ComponentStorageBase* ComponentStorageBase::fromTypeId(uint32_t type_id)
+{
+    return storageByTypeId()[type_id];
+}
+
+uint32_t ComponentStorageBase::getTypeCount()
+{
+    return static_cast<uint32_t>(storageByTypeId().size());
 }
 
-void ComponentStorageBase::destroyAll(uint32_t index)
+void ComponentStorageBase::compactAll()
 {
+    if (compaction_pins > 0)
+        return;
     for(auto storage = all_component_storage; storage; storage = storage->next)
-        storage->destroy(index);
+        storage->compact();
 }
 
 void ComponentStorageBase::dumpDebugInfo()
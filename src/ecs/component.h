@@ -12,12 +12,25 @@ public:
     ComponentStorageBase();
 
     static void dumpDebugInfo();
+    // Close the free slots in storages where a large part of the slots is free. Call this when nothing is iterating over components.
+    //  Does nothing while compaction is pinned.
+    static void compactAll();
+    // Iterations that keep their position over multiple frames (script loops) pin compaction, as it moves components in the dense storage.
+    static void pinCompaction() { compaction_pins++; }
+    static void unpinCompaction() { compaction_pins--; }
+
+    // Each component type gets a sequential id, used for the component signature of entities.
+    uint32_t getTypeId() const { return type_id; }
+    static ComponentStorageBase* fromTypeId(uint32_t type_id);
+    static uint32_t getTypeCount();
 private:
     ComponentStorageBase* next = nullptr;
+    uint32_t type_id;
+    static inline int compaction_pins = 0;
 protected:
-    static void destroyAll(uint32_t index);
     virtual void destroy(uint32_t index) = 0;
     virtual void dumpDebugInfoImpl() = 0;
+    virtual void compact() = 0;
 
     friend class Entity;
 };
@@ -31,6 +44,12 @@ private:
         sparseset.remove(index);
     }
 
+    void compact() override
+    {
+        if (sparseset.freeCount() > SparseSet<T>::chunk_size && sparseset.freeCount() * 4 > sparseset.size())
+            sparseset.compact();
+    }
+
     virtual void dumpDebugInfoImpl() override
     {
         if (storage.sparseset.size())
@@ -42,6 +61,7 @@ private:
     static ComponentStorage<T> storage;
 
     friend class Entity;
+    friend class CommandBuffer;
     template<class, class...> friend class Query;
     friend class ComponentReplication<T>;
 };
@@ -2,6 +2,10 @@
 #include "component.h"
 #include "logging.h"
 #include <vector>
+#include <algorithm>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 namespace sp::ecs {
 
@@ -9,6 +13,20 @@ std::vector<uint32_t> Entity::entity_version;
 std::vector<uint32_t> Entity::free_list;
 
 std::function<void(Entity)> Entity::pre_destroy_callback;
+std::unique_ptr<std::atomic<uint64_t>[]> Entity::component_signature;
+size_t Entity::signature_capacity = 0;
+uint32_t Entity::signature_words = 0;
+
+static inline uint32_t lowestBit(uint64_t bits)
+{
+#if defined(_MSC_VER)
+	unsigned long result;
+	_BitScanForward64(&result, bits);
+	return result;
+#else
+	return __builtin_ctzll(bits);
+#endif
+}
 
 Entity Entity::create()
 {
@@ -17,6 +35,8 @@ Entity Entity::create()
 		e.index = entity_version.size();
 		e.version = 0;
 		entity_version.push_back(0);
+		if (entity_version.size() > signature_capacity)
+			resizeSignatures(std::max<size_t>(1024, signature_capacity * 2), signature_words);
 	} else {
 		e.index = free_list.back();
 		free_list.pop_back();
@@ -70,7 +90,13 @@ void Entity::destroy()
 		if (!*this)
 			return;
 	}
-	ComponentStorageBase::destroyAll(index);
+	if (index < signature_capacity) {
+		for(uint32_t word = 0; word < signature_words; word++) {
+			auto bits = component_signature[index * signature_words + word].exchange(0);
+			for(; bits; bits &= bits - 1)
+				ComponentStorageBase::fromTypeId(word * 64 + lowestBit(bits))->destroy(index);
+		}
+	}
 	
 	// By increasing the version number, everything else will know this entity no longer exists.
 	entity_version[index] = (entity_version[index] + 1) | destroyed_flag;
@@ -100,6 +126,36 @@ void Entity::destroyAllEntities()
 	}
 }
 
+void Entity::addToSignature(uint32_t type_id)
+{
+	if (index >= signature_capacity)
+		return;
+	if (type_id >= signature_words * 64)
+		resizeSignatures(signature_capacity, (std::max(type_id + 1, ComponentStorageBase::getTypeCount()) + 63) / 64);
+	component_signature[index * signature_words + type_id / 64].fetch_or(uint64_t(1) << (type_id % 64), std::memory_order_relaxed);
+}
+
+void Entity::removeFromSignature(uint32_t type_id)
+{
+	if (index >= signature_capacity || type_id >= signature_words * 64)
+		return;
+	component_signature[index * signature_words + type_id / 64].fetch_and(~(uint64_t(1) << (type_id % 64)), std::memory_order_relaxed);
+}
+
+void Entity::resizeSignatures(size_t entity_count, uint32_t words)
+{
+	words = std::max(words, (ComponentStorageBase::getTypeCount() + 63) / 64);
+	auto new_signature = std::make_unique<std::atomic<uint64_t>[]>(entity_count * words);
+	for(size_t n = 0; n < entity_count * words; n++)
+		new_signature[n] = 0;
+	for(size_t e = 0; e < signature_capacity; e++)
+		for(uint32_t w = 0; w < signature_words; w++)
+			new_signature[e * words + w] = component_signature[e * signature_words + w].load();
+	component_signature = std::move(new_signature);
+	signature_capacity = entity_count;
+	signature_words = words;
+}
+
 void Entity::dumpDebugInfo()
 {
 	LOG(Debug, "Entity count:", entity_version.size() - free_list.size(), " Free entities:", free_list.size());
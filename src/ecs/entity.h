@@ -3,6 +3,8 @@
 #include <stdint.h>
 #include <limits>
 #include <functional>
+#include <atomic>
+#include <memory>
 
 #include "component.h"
 
@@ -37,18 +39,22 @@ public:
 	}
 	template<class T> T& addComponent()
 	{
-		ComponentStorage<T>::storage.sparseset.set(index, {});
+		if (ComponentStorage<T>::storage.sparseset.set(index, {}))
+			addToSignature(ComponentStorage<T>::storage.getTypeId());
 		return ComponentStorage<T>::storage.sparseset.get(index);
 	}
 	template<class T, class... ARGS> T& addComponent(ARGS&&... args)
 	{
-		ComponentStorage<T>::storage.sparseset.set(index, T{std::forward<ARGS>(args)...});
+		if (ComponentStorage<T>::storage.sparseset.set(index, T{std::forward<ARGS>(args)...}))
+			addToSignature(ComponentStorage<T>::storage.getTypeId());
 		return ComponentStorage<T>::storage.sparseset.get(index);
 	}
 	template<class T> T& getOrAddComponent()
 	{
-		if (!hasComponent<T>())
+		if (!hasComponent<T>()) {
 			ComponentStorage<T>::storage.sparseset.set(index, {});
+			addToSignature(ComponentStorage<T>::storage.getTypeId());
+		}
 		return ComponentStorage<T>::storage.sparseset.get(index);
 	}
 	template<class T> bool hasComponent() const
@@ -57,7 +63,8 @@ public:
 	}
 	template<class T> void removeComponent()
 	{
-		ComponentStorage<T>::storage.sparseset.remove(index);
+		if (ComponentStorage<T>::storage.sparseset.remove(index))
+			removeFromSignature(ComponentStorage<T>::storage.getTypeId());
 	}
 
 	bool operator==(const Entity& other) const;
@@ -86,11 +93,21 @@ private:
 	uint32_t version = no_index;
 
 	static Entity fromIndex(uint32_t index);
+	// The component signature has a bit for each component type the entity has, so destroy() only visits those storages.
+	//	Bits are set atomically, as systems on different threads can add components of different types to the same entity.
+	void addToSignature(uint32_t type_id);
+	void removeFromSignature(uint32_t type_id);
+	static void resizeSignatures(size_t entity_count, uint32_t words);
+	static std::unique_ptr<std::atomic<uint64_t>[]> component_signature;
+	static size_t signature_capacity;
+	static uint32_t signature_words;
+
 	static std::vector<uint32_t> entity_version;
 	static std::vector<uint32_t> free_list;
 	static std::function<void(Entity)> pre_destroy_callback;
 
 	template<class, class...> friend class Query;
+	friend class Snapshot;
 
 	friend class ::MultiplayerObject;	// We need to be a friend for network replication.
 	friend class ::GameServer;	// We need to be a friend for network replication.
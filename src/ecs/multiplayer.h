@@ -55,6 +55,7 @@ public:
                 packet << CMD_ECS_DEL_COMPONENT << component_index << index;
             }
         }
+        component_copy.compact();
     }
 
     void receive(sp::ecs::Entity entity, sp::io::DataBuffer& packet) override
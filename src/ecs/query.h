@@ -2,6 +2,8 @@
 
 #include "ecs/entity.h"
 #include "ecs/component.h"
+#include "threadPool.h"
+#include <tuple>
 
 
 namespace sp::ecs {
@@ -19,20 +21,32 @@ template<typename T> struct optional_info<optional<T>> {
     static constexpr bool value = true;
 };
 
+// Iterate all entities that have all the given components, components wrapped in optional<> are given as a pointer that can be null.
+//  The iteration runs over the smallest of the required component storages, and checks the others for each entity.
 template<class PRIMARY, class... T> class Query {
 public:
     class Iterator {
     public:
-        Iterator(int) : iterator(ComponentStorage<PRIMARY>::storage.sparseset.begin()) { while(checkForSkip()) {} }
-        Iterator() : iterator(ComponentStorage<PRIMARY>::storage.sparseset.end()) {}
+        Iterator(const std::vector<uint32_t>* dense, size_t position)
+        : dense(dense), position(position), dense_is_primary(dense == &ComponentStorage<PRIMARY>::storage.sparseset.denseIndices()) { skip(); }
+        Iterator() : dense(nullptr), position(0), dense_is_primary(false) {}
 
-        bool operator!=(const Iterator& other) const { return iterator != other.iterator; }
-        void operator++() { ++iterator; while(checkForSkip()) {} }
+        bool operator!=(const Iterator& other) const {
+            if (!other.dense)
+                return !atEnd();
+            return position != other.position;
+        }
+        void operator++() { ++position; skip(); }
         std::tuple<Entity, PRIMARY&, typename optional_info<T>::ref_type...> operator*() {
-            auto [index, primary] = *iterator;
-            return {Entity::fromIndex(index), primary, getComponent<T>(index)...};
+            auto index = (*dense)[position];
+            auto& sparseset = ComponentStorage<PRIMARY>::storage.sparseset;
+            return {Entity::fromIndex(index), dense_is_primary ? sparseset.getDense(position) : sparseset.get(index), getComponent<T>(index)...};
         }
-    
+
+        bool atEnd() const { return !dense || position >= dense->size(); }
+        size_t denseIndex() const { return position; }
+        // Skip entities that no longer match, for iterators that are kept while entities or components change.
+        void refresh() { skip(); }
     private:
         template<typename T2> typename optional_info<T2>::ref_type getComponent(uint32_t index)
         {
@@ -46,37 +60,69 @@ public:
             }
         }
 
-        bool checkForSkip() {
-            if (iterator.atEnd()) return false;
-            if constexpr (sizeof...(T) > 0) {
-                if (!checkIfHasAll<T...>()) {
-                    ++iterator;
-                    return true;
-                }
+        void skip() {
+            while(!atEnd()) {
+                auto index = (*dense)[position];
+                // A used slot in the iterated storage has that component, only the other storages need a lookup.
+                if (!(index & SparseSet<PRIMARY>::free_mark) && (dense_is_primary || ComponentStorage<PRIMARY>::storage.sparseset.has(index)) && (hasRequired<T>(index) && ...))
+                    return;
+                ++position;
             }
-            return false;
         }
-        template<typename T2, typename... ARGS> bool checkIfHasAll() {
-            if constexpr (!optional_info<T2>::value) {
-                auto index = (*iterator).first;
-                if (!ComponentStorage<T2>::storage.sparseset.has(index))
-                    return false;
-            }
-            if constexpr (sizeof...(ARGS) > 0)
-                return checkIfHasAll<ARGS...>();
-            return true;
+        template<typename T2> static bool hasRequired(uint32_t index) {
+            if constexpr (optional_info<T2>::value)
+                return true;
+            else
+                return ComponentStorage<T2>::storage.sparseset.has(index);
         }
 
-        typename SparseSet<PRIMARY>::Iterator iterator;
+        const std::vector<uint32_t>* dense;
+        size_t position;
+        bool dense_is_primary;
     };
 
     Iterator begin() {
-        return Iterator(0);
+        return Iterator(smallestStorage(), 0);
     }
 
     Iterator end() {
         return Iterator();
     }
+
+    // Call func(entity, primary, components...) for all matching entities, spread over the ThreadPool in chunks of the iterated storage.
+    //  func runs on worker threads, so it cannot create or destroy entities or add or remove components,
+    //  and it may only modify the components it is given. Record structural changes in a CommandBuffer instead.
+    template<typename FUNC> void parallel_for_each(FUNC func) {
+        constexpr size_t chunk_size = SparseSet<PRIMARY>::chunk_size;
+        auto dense = smallestStorage();
+        auto count = dense->size();
+        if (count <= chunk_size) {
+            for(auto it = Iterator(dense, 0); !it.atEnd(); ++it)
+                std::apply(func, *it);
+            return;
+        }
+        ThreadPool::Group group(ThreadPool::get());
+        for(size_t start = 0; start < count; start += chunk_size) {
+            group.submit([dense, start, end=std::min(start + chunk_size, count), &func]() {
+                for(Iterator it(dense, start); !it.atEnd() && it.denseIndex() < end; ++it)
+                    std::apply(func, *it);
+            });
+        }
+        group.wait();
+    }
+private:
+    static const std::vector<uint32_t>* smallestStorage() {
+        const std::vector<uint32_t>* result = &ComponentStorage<PRIMARY>::storage.sparseset.denseIndices();
+        (pickSmaller<T>(result), ...);
+        return result;
+    }
+    template<typename T2> static void pickSmaller(const std::vector<uint32_t>*& result) {
+        if constexpr (!optional_info<T2>::value) {
+            auto& dense = ComponentStorage<T2>::storage.sparseset.denseIndices();
+            if (dense.size() < result->size())
+                result = &dense;
+        }
+    }
 };
 
-}
\ No newline at end of file
+}
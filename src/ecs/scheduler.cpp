@@ -0,0 +1,152 @@
+#include "ecs/scheduler.h"
+#include "threadPool.h"
+#include "profiler.h"
+#include "timer.h"
+
+#include <typeinfo>
+
+
+namespace sp::ecs {
+
+bool SystemAccess::conflictsWith(const SystemAccess& other) const
+{
+    if (main_thread_only || other.main_thread_only)
+        return true;
+    for(auto& type : writes)
+        if (other.reads.count(type) || other.writes.count(type))
+            return true;
+    for(auto& type : other.writes)
+        if (reads.count(type))
+            return true;
+    return false;
+}
+
+void SystemScheduler::add(System* system)
+{
+    systems.push_back(system);
+    graph_dirty = true;
+}
+
+void SystemScheduler::buildGraph()
+{
+    nodes.clear();
+    nodes.resize(systems.size());
+    for(size_t n=0; n<systems.size(); n++)
+    {
+        systems[n]->declareAccess(nodes[n].access);
+        nodes[n].profiler_zone = sp::profiler::Zone::intern(typeid(*systems[n]).name());
+        for(size_t m=0; m<n; m++)
+        {
+            if (nodes[m].access.conflictsWith(nodes[n].access))
+            {
+                nodes[m].dependents.push_back(n);
+                nodes[n].dependency_count++;
+            }
+        }
+    }
+    remaining_dependencies = std::make_unique<std::atomic<size_t>[]>(systems.size());
+    system_times.assign(systems.size(), 0.0f);
+    graph_dirty = false;
+}
+
+void SystemScheduler::update(float delta)
+{
+    SP_PROFILE_ZONE("systems");
+    if (graph_dirty)
+        buildGraph();
+    sp::SystemStopwatch stopwatch;
+
+    {
+        std::lock_guard<std::mutex> lock(ready->mutex);
+        finished_count = 0;
+    }
+    for(size_t n=0; n<nodes.size(); n++)
+        remaining_dependencies[n] = nodes[n].dependency_count;
+    current_delta = delta;
+    for(size_t n=0; n<nodes.size(); n++)
+        if (nodes[n].dependency_count == 0)
+            schedule(n);
+
+    std::unique_lock<std::mutex> lock(ready->mutex);
+    while(finished_count < nodes.size())
+    {
+        size_t index;
+        if (takeReady(ready->main_thread, index) || takeReady(ready->worker, index))
+        {
+            lock.unlock();
+            run(index);
+            lock.lock();
+        }
+        else
+        {
+            ready->signal.wait(lock);
+        }
+    }
+    lock.unlock();
+    command_buffer.playback();
+    wall_time = stopwatch.get();
+}
+
+void SystemScheduler::schedule(size_t index)
+{
+    bool main_thread_only = nodes[index].access.isMainThreadOnly();
+    {
+        std::lock_guard<std::mutex> lock(ready->mutex);
+        (main_thread_only ? ready->main_thread : ready->worker).push_back(index);
+    }
+    ready->signal.notify_one();
+    //Without workers the main thread runs everything, do not leave jobs in the pool that nobody takes.
+    if (!main_thread_only && ThreadPool::get().getWorkerCount() > 0)
+    {
+        ThreadPool::get().submit([this, queue=ready]()
+        {
+            size_t index;
+            {
+                std::lock_guard<std::mutex> lock(queue->mutex);
+                if (!takeReady(queue->worker, index))
+                    return;
+            }
+            run(index);
+        });
+    }
+}
+
+bool SystemScheduler::takeReady(std::vector<size_t>& list, size_t& index)
+{
+    if (list.empty())
+        return false;
+    index = list.back();
+    list.pop_back();
+    return true;
+}
+
+void SystemScheduler::run(size_t index)
+{
+    sp::SystemStopwatch stopwatch;
+    {
+        sp::profiler::Scope scope(nodes[index].profiler_zone);
+        systems[index]->update(current_delta);
+    }
+    system_times[index] = stopwatch.get();
+
+    for(auto dependent : nodes[index].dependents)
+        if (--remaining_dependencies[dependent] == 0)
+            schedule(dependent);
+    {
+        std::lock_guard<std::mutex> lock(ready->mutex);
+        finished_count++;
+    }
+    ready->signal.notify_one();
+}
+
+float SystemScheduler::getParallelEfficiency() const
+{
+    if (wall_time <= 0.0f)
+        return 1.0f;
+    float total = 0.0f;
+    for(auto t : system_times)
+        total += t;
+    return total / (wall_time * static_cast<float>(ThreadPool::get().getWorkerCount() + 1));
+}
+
+}
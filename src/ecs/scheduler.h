@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "ecs/system.h"
+#include "ecs/commandBuffer.h"
+
+
+namespace sp::ecs {
+
+// Runs systems in parallel where their declared component access allows it.
+//  A system never runs at the same time as an earlier registered system it conflicts with,
+//  so the result is the same as running all systems in registration order.
+class SystemScheduler {
+public:
+    void add(System* system);
+    const std::vector<System*>& getSystems() const { return systems; }
+
+    void update(float delta);
+
+    // Command buffer that is played back after all systems finished their update.
+    //  Systems running on worker threads use this for entity creation and destruction, and adding or removing components.
+    CommandBuffer& getCommandBuffer() { return command_buffer; }
+
+    // Time spend in each system during the last update, in the same order as getSystems().
+    const std::vector<float>& getSystemTimes() const { return system_times; }
+    // Time the whole last update took.
+    float getWallTime() const { return wall_time; }
+    // Total system time divided by the time available on all threads during the last update. 1.0 means all threads were busy all the time.
+    float getParallelEfficiency() const;
+private:
+    void buildGraph();
+    void schedule(size_t index);
+    void run(size_t index);
+    static bool takeReady(std::vector<size_t>& list, size_t& index);
+
+    struct Node {
+        SystemAccess access;
+        std::vector<size_t> dependents;
+        size_t dependency_count = 0;
+        uint32_t profiler_zone = 0;
+    };
+
+    std::vector<System*> systems;
+    std::vector<Node> nodes;
+    CommandBuffer command_buffer;
+    bool graph_dirty = false;
+
+    std::vector<float> system_times;
+    float wall_time = 0.0f;
+    float current_delta = 0.0f;
+
+    // Systems that are ready to run. The main thread only runs systems from these lists while it waits, never other jobs of the thread pool.
+    //  Each system on the worker list also has a job in the thread pool, which finds nothing to do if the main thread took the system first.
+    //  Those jobs can run after update() returned, so they keep this alive instead of referring to the scheduler.
+    struct ReadyQueue {
+        std::mutex mutex;
+        std::condition_variable signal;
+        std::vector<size_t> main_thread;
+        std::vector<size_t> worker;
+    };
+
+    std::unique_ptr<std::atomic<size_t>[]> remaining_dependencies;
+    size_t finished_count = 0; // Guarded by ready->mutex
+    std::shared_ptr<ReadyQueue> ready = std::make_shared<ReadyQueue>();
+};
+
+}
@@ -0,0 +1,408 @@
+#include "ecs/snapshot.h"
+#include "io/mappedFile.h"
+#include "logging.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <zstd/zstd.h>
+
+
+namespace sp::ecs {
+
+namespace {
+static constexpr char snapshot_magic[4] = {'S', 'P', 'S', 'S'};
+static constexpr uint32_t snapshot_version = 1;
+static constexpr uint32_t file_flag_delta = 0x01;
+static constexpr uint32_t chunk_flag_zstd = 0x01;
+static constexpr uint32_t chunk_entities = 0;
+static constexpr uint32_t chunk_component = 1;
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t chunk_count;
+    uint64_t id;        // Hash of the full state, also for delta snapshots.
+    uint64_t base_id;   // For delta snapshots, the id of the snapshot this one is based on.
+};
+
+struct ChunkHeader {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t size;
+    uint64_t stored_size;
+};
+
+uint64_t hashData(const std::vector<uint8_t>& data, uint64_t hash = 0xcbf29ce484222325ULL)
+{
+    for(auto c : data)
+    {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+void appendU32(std::vector<uint8_t>& data, uint32_t value)
+{
+    auto offset = data.size();
+    data.resize(offset + sizeof(value));
+    memcpy(data.data() + offset, &value, sizeof(value));
+}
+
+void appendU32s(std::vector<uint8_t>& data, const uint32_t* values, size_t count)
+{
+    auto offset = data.size();
+    data.resize(offset + sizeof(uint32_t) * count);
+    if (count)
+        memcpy(data.data() + offset, values, sizeof(uint32_t) * count);
+}
+
+bool readU32(const uint8_t*& ptr, const uint8_t* end, uint32_t& value)
+{
+    if (end - ptr < static_cast<ptrdiff_t>(sizeof(value)))
+        return false;
+    memcpy(&value, ptr, sizeof(value));
+    ptr += sizeof(value);
+    return true;
+}
+
+bool readU32s(const uint8_t*& ptr, const uint8_t* end, uint32_t count, std::vector<uint32_t>& values)
+{
+    if (static_cast<size_t>(end - ptr) / sizeof(uint32_t) < count)
+        return false;
+    values.resize(count);
+    if (count)
+        memcpy(values.data(), ptr, sizeof(uint32_t) * count);
+    ptr += sizeof(uint32_t) * count;
+    return true;
+}
+}
+
+std::vector<Snapshot::Chunk> Snapshot::capture()
+{
+    std::vector<Chunk> chunks;
+    auto& entities = chunks.emplace_back();
+    entities.type = chunk_entities;
+    appendU32(entities.data, static_cast<uint32_t>(Entity::entity_version.size()));
+    appendU32s(entities.data, Entity::entity_version.data(), Entity::entity_version.size());
+    appendU32(entities.data, static_cast<uint32_t>(Entity::free_list.size()));
+    appendU32s(entities.data, Entity::free_list.data(), Entity::free_list.size());
+
+    std::vector<uint32_t> indices;
+    for(auto& component : components)
+    {
+        sp::io::DataBuffer values;
+        indices.clear();
+        component->save(indices, values);
+
+        auto& chunk = chunks.emplace_back();
+        chunk.type = chunk_component;
+        chunk.name = component->name;
+        appendU32(chunk.data, static_cast<uint32_t>(component->name.size()));
+        chunk.data.insert(chunk.data.end(), component->name.begin(), component->name.end());
+        appendU32(chunk.data, static_cast<uint32_t>(indices.size()));
+        appendU32s(chunk.data, indices.data(), indices.size());
+        auto values_data = static_cast<const uint8_t*>(values.getData());
+        chunk.data.insert(chunk.data.end(), values_data, values_data + values.getDataSize());
+    }
+    return chunks;
+}
+
+bool Snapshot::restoreEntities(const uint8_t* data, size_t size, bool delta)
+{
+    const uint8_t* end = data + size;
+    uint32_t count = 0, free_count = 0;
+    std::vector<uint32_t> versions, free_list;
+    if (!readU32(data, end, count) || !readU32s(data, end, count, versions) || !readU32(data, end, free_count) || !readU32s(data, end, free_count, free_list))
+    {
+        LOG(Error, "Snapshot has a corrupt entity chunk");
+        return false;
+    }
+    // Entity::create() takes indices from the free list, so those have to be destroyed slots.
+    for(auto index : free_list)
+    {
+        if (index >= count || !(versions[index] & Entity::destroyed_flag))
+        {
+            LOG(Error, "Snapshot has a corrupt entity free list");
+            return false;
+        }
+    }
+
+    if (delta)
+    {
+        // Destroy the entities that no longer exist. Entities that got replaced by a different entity on the same index keep their components,
+        //  as unchanged component chunks are not in the delta, and the changed ones are fully reloaded.
+        for(uint32_t index = 0; index < Entity::entity_version.size(); index++)
+        {
+            auto current = Entity::entity_version[index];
+            if (!(current & Entity::destroyed_flag) && (index >= count || (versions[index] & Entity::destroyed_flag)))
+                Entity::forced(index, current).destroy();
+        }
+    }
+    else
+    {
+        Entity::destroyAllEntities();
+    }
+    Entity::entity_version = std::move(versions);
+    Entity::free_list = std::move(free_list);
+    if (Entity::entity_version.size() > Entity::signature_capacity)
+        Entity::resizeSignatures(Entity::entity_version.size(), Entity::signature_words);
+    return true;
+}
+
+bool Snapshot::load(const string& filename)
+{
+    return load(std::vector<string>{filename});
+}
+
+bool Snapshot::load(const std::vector<string>& filenames)
+{
+    uint64_t id = 0;
+    for(auto& filename : filenames)
+    {
+        if (!loadFile(filename, id, id))
+            return false;
+    }
+    return true;
+}
+
+bool Snapshot::loadFile(const string& filename, uint64_t base_id, uint64_t& id)
+{
+    sp::io::MappedFile file;
+    if (!file.open(filename))
+    {
+        LOG(Error, "Failed to open snapshot: ", filename);
+        return false;
+    }
+    const uint8_t* ptr = file.data();
+    const uint8_t* end = ptr + file.size();
+    FileHeader header;
+    if (file.size() < sizeof(header))
+    {
+        LOG(Error, "Snapshot too small: ", filename);
+        return false;
+    }
+    memcpy(&header, ptr, sizeof(header));
+    ptr += sizeof(header);
+    if (memcmp(header.magic, snapshot_magic, sizeof(snapshot_magic)) != 0 || header.version != snapshot_version)
+    {
+        LOG(Error, "Not a snapshot, or unsupported version: ", filename);
+        return false;
+    }
+    bool delta = header.flags & file_flag_delta;
+    if (!delta && base_id != 0)
+    {
+        LOG(Error, "Expected a delta snapshot, but ", filename, " is a full snapshot");
+        return false;
+    }
+    if (delta && header.base_id != base_id)
+    {
+        LOG(Error, "Delta snapshot ", filename, " is not based on the snapshot loaded before it");
+        return false;
+    }
+
+    for(uint32_t n=0; n<header.chunk_count; n++)
+    {
+        ChunkHeader chunk;
+        if (static_cast<size_t>(end - ptr) < sizeof(chunk))
+        {
+            LOG(Error, "Snapshot truncated: ", filename);
+            return false;
+        }
+        memcpy(&chunk, ptr, sizeof(chunk));
+        ptr += sizeof(chunk);
+        if (static_cast<uint64_t>(end - ptr) < chunk.stored_size)
+        {
+            LOG(Error, "Snapshot truncated: ", filename);
+            return false;
+        }
+        const uint8_t* data = ptr;
+        size_t size = chunk.stored_size;
+        ptr += chunk.stored_size;
+        // Compressed chunks are decompressed straight from the mapped file, and the result becomes the component data buffer without another copy.
+        std::vector<uint8_t> decompressed;
+        if (chunk.flags & chunk_flag_zstd)
+        {
+            // The frame records its own size, so a damaged chunk header cannot make us allocate more than the data decompresses to.
+            if (ZSTD_getFrameContentSize(data, size) != chunk.size)
+            {
+                LOG(Error, "Snapshot chunk does not match its compressed data in ", filename);
+                return false;
+            }
+            decompressed.resize(chunk.size);
+            auto result = ZSTD_decompress(decompressed.data(), decompressed.size(), data, size);
+            if (ZSTD_isError(result) || result != chunk.size)
+            {
+                LOG(Error, "Failed to decompress snapshot chunk in ", filename);
+                return false;
+            }
+            data = decompressed.data();
+            size = decompressed.size();
+        }
+
+        if (chunk.type == chunk_entities)
+        {
+            if (!restoreEntities(data, size, delta))
+                return false;
+        }
+        else if (chunk.type == chunk_component)
+        {
+            const uint8_t* chunk_end = data + size;
+            uint32_t name_length = 0, count = 0;
+            std::vector<uint32_t> indices;
+            if (!readU32(data, chunk_end, name_length) || static_cast<size_t>(chunk_end - data) < name_length)
+            {
+                LOG(Error, "Snapshot has a corrupt component chunk: ", filename);
+                return false;
+            }
+            string name(reinterpret_cast<const char*>(data), name_length);
+            data += name_length;
+            if (!readU32(data, chunk_end, count) || !readU32s(data, chunk_end, count, indices))
+            {
+                LOG(Error, "Snapshot has a corrupt component chunk: ", filename);
+                return false;
+            }
+            for(auto index : indices)
+            {
+                if (index >= Entity::entity_version.size() || (Entity::entity_version[index] & Entity::destroyed_flag))
+                {
+                    LOG(Error, "Snapshot has a ", name, " component on an entity that does not exist: ", filename);
+                    return false;
+                }
+            }
+            ComponentBase* component = nullptr;
+            for(auto& c : components)
+                if (c->name == name)
+                    component = c.get();
+            if (!component)
+            {
+                LOG(Warning, "Snapshot contains unknown component type: ", name);
+                continue;
+            }
+            sp::io::DataBuffer values;
+            if (decompressed.empty())
+            {
+                values = std::vector<uint8_t>(data, chunk_end);
+            }
+            else
+            {
+                auto offset = static_cast<size_t>(data - decompressed.data());
+                values = std::move(decompressed);
+                values.skip(offset);
+            }
+            component->clear();
+            component->load(indices.data(), count, values);
+        }
+    }
+    id = header.id;
+    return true;
+}
+
+Snapshot::Writer::~Writer()
+{
+    wait();
+}
+
+bool Snapshot::Writer::isBusy()
+{
+    return busy;
+}
+
+bool Snapshot::Writer::wait()
+{
+    if (thread.joinable())
+        thread.join();
+    return success;
+}
+
+bool Snapshot::Writer::save(const string& filename, bool delta, bool compress)
+{
+    if (busy)
+        return false;
+    if (thread.joinable())
+        thread.join();
+
+    // Only the copy of the ECS state is done on the calling thread.
+    busy = true;
+    thread = std::thread([this, filename, delta, compress, chunks=capture()]() mutable
+    {
+        std::unordered_map<string, uint64_t> hashes;
+        uint64_t id = 0xcbf29ce484222325ULL;
+        for(auto& chunk : chunks)
+        {
+            auto hash = hashData(chunk.data);
+            if (chunk.type == chunk_component)
+                hashes[chunk.name] = hash;
+            id = (id ^ hash) * 0x100000001b3ULL;
+        }
+
+        bool write_delta = delta && previous_id != 0;
+        FileHeader header;
+        memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+        header.version = snapshot_version;
+        header.flags = write_delta ? file_flag_delta : 0;
+        header.chunk_count = 0;
+        header.id = id;
+        header.base_id = write_delta ? previous_id : 0;
+
+        std::vector<uint8_t> output(sizeof(header));
+        for(auto& chunk : chunks)
+        {
+            if (write_delta && chunk.type == chunk_component)
+            {
+                auto it = previous_hashes.find(chunk.name);
+                if (it != previous_hashes.end() && it->second == hashes[chunk.name])
+                    continue;
+            }
+            ChunkHeader chunk_header{chunk.type, 0, chunk.data.size(), chunk.data.size()};
+            const std::vector<uint8_t>* stored = &chunk.data;
+            std::vector<uint8_t> compressed;
+            if (compress && !chunk.data.empty())
+            {
+                compressed.resize(ZSTD_compressBound(chunk.data.size()));
+                auto result = ZSTD_compress(compressed.data(), compressed.size(), chunk.data.data(), chunk.data.size(), 1);
+                if (!ZSTD_isError(result) && result < chunk.data.size())
+                {
+                    compressed.resize(result);
+                    stored = &compressed;
+                    chunk_header.flags = chunk_flag_zstd;
+                    chunk_header.stored_size = result;
+                }
+            }
+            auto offset = output.size();
+            output.resize(offset + sizeof(chunk_header) + stored->size());
+            memcpy(output.data() + offset, &chunk_header, sizeof(chunk_header));
+            if (!stored->empty())
+                memcpy(output.data() + offset + sizeof(chunk_header), stored->data(), stored->size());
+            header.chunk_count++;
+        }
+        memcpy(output.data(), &header, sizeof(header));
+
+        // Write to a temporary file first, so a crash while saving does not destroy the previous save.
+        string temp_filename = filename + ".tmp";
+        {
+            std::ofstream file(temp_filename.c_str(), std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(output.data()), output.size());
+            success = bool(file);
+        }
+        std::error_code ec;
+        if (success)
+            std::filesystem::rename(temp_filename.c_str(), filename.c_str(), ec);
+        if (!success || ec)
+        {
+            success = false;
+            LOG(Error, "Failed to write snapshot: ", filename);
+        }
+        else
+        {
+            previous_id = id;
+            previous_hashes = std::move(hashes);
+        }
+        busy = false;
+    });
+    return true;
+}
+
+}
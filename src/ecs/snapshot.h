@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "io/dataBuffer.h"
+#include "ecs/entity.h"
+#include "ecs/query.h"
+
+
+namespace sp::ecs {
+
+// Binary snapshots of all entities and registered components, for savegames.
+//  The file has a chunk with the entity versions, and a chunk per component type that stores a column of entity indices followed by a column of component data.
+//  Components are stored with the same DataBuffer operators that are used for multiplayer replication.
+class Snapshot {
+public:
+    // Components are stored under this name, so type ids can change between builds.
+    template<typename T> static void registerComponent(const string& name) {
+        components.push_back(std::make_unique<Component<T>>(name));
+    }
+
+    // Replace all entities and registered components with the ones from a full snapshot.
+    static bool load(const string& filename);
+    // Load a full snapshot followed by the delta snapshots saved after it, each delta has to be based on the file before it.
+    //  The chain is loaded in one call, as any change to the world between the files would not be covered by the deltas.
+    static bool load(const std::vector<string>& filenames);
+
+    // Takes snapshots on the calling thread, and compresses and writes them on a background thread, so the simulation only pauses for the copy.
+    class Writer {
+    public:
+        ~Writer();
+
+        // With delta, component types that did not change since the previous save from this writer are not stored.
+        //  Returns false if the previous save is still being written.
+        bool save(const string& filename, bool delta=false, bool compress=true);
+        bool isBusy();
+        // Wait till the last save is written, returns false if writing it failed.
+        bool wait();
+    private:
+        std::thread thread;
+        std::atomic<bool> busy = false;
+        std::atomic<bool> success = true;
+        uint64_t previous_id = 0;
+        std::unordered_map<string, uint64_t> previous_hashes;
+    };
+private:
+    class ComponentBase {
+    public:
+        ComponentBase(const string& name) : name(name) {}
+        virtual ~ComponentBase() = default;
+
+        virtual void save(std::vector<uint32_t>& indices, sp::io::DataBuffer& data) = 0;
+        virtual void clear() = 0;
+        virtual void load(const uint32_t* indices, uint32_t count, sp::io::DataBuffer& data) = 0;
+
+        string name;
+    };
+    template<typename T> class Component : public ComponentBase {
+    public:
+        using ComponentBase::ComponentBase;
+
+        void save(std::vector<uint32_t>& indices, sp::io::DataBuffer& data) override {
+            for(auto [entity, component] : Query<T>()) {
+                indices.push_back(entity.getIndex());
+                data << component;
+            }
+        }
+        void clear() override {
+            for(auto [entity, component] : Query<T>())
+                entity.template removeComponent<T>();
+        }
+        // The indices have been checked to be entities that exist.
+        void load(const uint32_t* indices, uint32_t count, sp::io::DataBuffer& data) override {
+            for(uint32_t n=0; n<count; n++) {
+                T component;
+                data >> component;
+                Entity::fromIndex(indices[n]).addComponent<T>(std::move(component));
+            }
+        }
+    };
+
+    struct Chunk {
+        uint32_t type;
+        string name;
+        std::vector<uint8_t> data;
+    };
+    static std::vector<Chunk> capture();
+    static bool restoreEntities(const uint8_t* data, size_t size, bool delta);
+    // With base_id 0 the file has to be a full snapshot, else a delta based on that id. Gives the id of the loaded state in id.
+    static bool loadFile(const string& filename, uint64_t base_id, uint64_t& id);
+
+    static inline std::vector<std::unique_ptr<ComponentBase>> components;
+};
+
+}
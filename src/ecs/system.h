@@ -1,10 +1,37 @@
 #pragma once
 
+#include <typeindex>
+#include <unordered_set>
+
 namespace sp::ecs {
 
+// Which components a system reads and writes, so the SystemScheduler knows which systems can run at the same time.
+class SystemAccess {
+public:
+    template<typename T> void read() { reads.insert(typeid(T)); }
+    template<typename T> void write() { writes.insert(typeid(T)); }
+    // The system uses state outside of components (scripts, PObjects, sound, rendering).
+    //  It runs on the main thread while no other system is running.
+    void mainThreadOnly() { main_thread_only = true; }
+
+    bool isMainThreadOnly() const { return main_thread_only; }
+    bool conflictsWith(const SystemAccess& other) const;
+private:
+    std::unordered_set<std::type_index> reads;
+    std::unordered_set<std::type_index> writes;
+    bool main_thread_only = false;
+};
+
 class System {
 public:
+    virtual ~System() = default;
+
     virtual void update(float delta) = 0;
+
+    // Override to declare the component access of this system, which allows it to run on a worker thread in parallel with other systems.
+    //  Systems that run on a worker thread cannot create or destroy entities, add or remove components other than the ones they write,
+    //  or touch anything that is not declared. Use the command buffer of the SystemScheduler to do those changes after all systems ran.
+    virtual void declareAccess(SystemAccess& access) { access.mainThreadOnly(); }
 };
 
-}
\ No newline at end of file
+}
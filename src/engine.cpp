@@ -4,10 +4,14 @@
 #include "audio/source.h"
 #include "io/keybinding.h"
 #include "soundManager.h"
+#include "textureManager.h"
 #include "windowManager.h"
 #include "multiplayer_server.h"
 #include "ecs/entity.h"
 #include "systems/collision.h"
+#include "profiler.h"
+#include "script/environment.h"
+#include "script/scheduler.h"
 
 #include <thread>
 #include <SDL.h>
@@ -30,6 +34,8 @@ PObject* DEBUG_PobjListStart;
 #endif
 
 Engine* engine;
+//Time per frame for the lua garbage collector, spreading collection over frames keeps it from causing a hitch.
+static constexpr float lua_gc_time = 0.001f;
 
 Engine::Engine()
 {
@@ -189,16 +195,25 @@ void Engine::runMainLoop()
                 update_delta = 0.001f;
             update_delta *= gameSpeed;
 
-            foreach(Updatable, u, updatableList)
+            foreach(Updatable, u, updatableList) {
+                sp::profiler::Scope scope(sp::profiler::Zone::intern(typeid(**u).name(), "update"));
                 u->update(update_delta);
-            for(auto system : systems)
-                system->update(update_delta);
-            sp::CollisionSystem::update(update_delta);
+            }
+            systems.update(update_delta);
+            {
+                SP_PROFILE_ZONE("collision");
+                sp::CollisionSystem::update(update_delta);
+            }
+            sp::ecs::ComponentStorageBase::compactAll();
+            sp::script::Environment::updateIsolated(update_delta);
+            sp::script::Scheduler::update(update_delta);
+            sp::script::Environment::updateFrame(lua_gc_time);
             elapsedTime += update_delta;
             soundManager->updateTick();
 #ifdef STEAMSDK
             SteamAPI_RunCallbacks();
 #endif
+            sp::profiler::endFrame();
             std::this_thread::sleep_for(std::chrono::duration<float>(1.f/60.f - realtime_delta));
         }
     }else{
@@ -228,39 +243,43 @@ void Engine::runMainLoop()
             if (delta < 0.001f)
                 delta = 0.001f;
             delta *= gameSpeed;
-            EngineTiming engine_timing;
-            
-            sp::SystemStopwatch engine_timing_stopwatch;
+
             foreach(Updatable, u, updatableList) {
-                auto name = string(typeid(**u).name());
+                sp::profiler::Scope scope(sp::profiler::Zone::intern(typeid(**u).name(), "update"));
                 u->update(delta);
-                engine_timing["update:" + name] = engine_timing_stopwatch.restart();
-            }
-            for(auto system : systems) {
-                system->update(delta);
-                engine_timing[typeid(*system).name()] = engine_timing_stopwatch.restart();
             }
+            systems.update(delta);
             elapsedTime += delta;
-            sp::CollisionSystem::update(delta);
-            engine_timing["collision"] = engine_timing_stopwatch.restart();
+            {
+                SP_PROFILE_ZONE("collision");
+                sp::CollisionSystem::update(delta);
+            }
+            sp::ecs::ComponentStorageBase::compactAll();
+            sp::script::Environment::updateIsolated(delta);
+            sp::script::Scheduler::update(delta);
+            sp::script::Environment::updateFrame(lua_gc_time);
             soundManager->updateTick();
 #ifdef STEAMSDK
             SteamAPI_RunCallbacks();
 #endif
 
-            // Clear the window
-            for(auto window : Window::all_windows)
-                window->render();
-            engine_timing["rendering"] = engine_timing_stopwatch.restart();
-            for (auto window : Window::all_windows)
-                window->swapBuffers();
-            engine_timing_stopwatch.restart(); // skip vsync interval in timing
+            {
+                SP_PROFILE_ZONE("texture_upload");
+                textureManager.update();
+            }
 
-            engine_timing["server_update"] = 0.0f;
-            if (game_server)
-                engine_timing["server_update"] = game_server->getUpdateTime();
-            
-            last_engine_timing = engine_timing;
+            {
+                SP_PROFILE_ZONE("rendering");
+                sp::RenderTarget::beginFrame();
+                for(auto window : Window::all_windows)
+                    window->render();
+            }
+            {
+                SP_PROFILE_ZONE("swap_buffers");
+                for (auto window : Window::all_windows)
+                    window->swapBuffers();
+            }
+            sp::profiler::endFrame();
 
             sp::io::Keybinding::allPostUpdate();
         }
@@ -380,7 +399,32 @@ float Engine::getElapsedTime()
 
 Engine::EngineTiming Engine::getEngineTiming()
 {
-    return last_engine_timing;
+    auto zones = sp::profiler::getLastFrame();
+    auto zoneTime = [&zones](const string& name) {
+        auto it = zones.find(name);
+        return it != zones.end() ? it->second : 0.0f;
+    };
+
+    EngineTiming timing;
+    foreach(Updatable, u, updatableList) {
+        auto key = "update:" + string(typeid(**u).name());
+        timing[key] = zoneTime(key);
+    }
+    for(size_t n=0; n<systems.getSystems().size(); n++)
+        timing[typeid(*systems.getSystems()[n]).name()] = systems.getSystemTimes()[n];
+    timing["systems"] = systems.getWallTime();
+    timing["systems:parallel_efficiency"] = systems.getParallelEfficiency();
+    timing["collision"] = zoneTime("collision");
+    timing["texture_upload"] = zoneTime("texture_upload");
+    timing["rendering"] = zoneTime("rendering");
+    //Part of the update:<server class> time above, not an extra phase.
+    timing["server_update"] = game_server ? game_server->getUpdateTime() : 0.0f;
+    return timing;
+}
+
+Engine::EngineTiming Engine::getProfilerTiming()
+{
+    return sp::profiler::getLastFrame();
 }
 
 void Engine::shutdown()
@@ -1,8 +1,9 @@
 #pragma once
 
+#include <map>
 #include <unordered_map>
 #include "stringImproved.h"
-#include "ecs/system.h"
+#include "ecs/scheduler.h"
 #include "P.h"
 
 #ifdef WIN32
@@ -26,14 +27,13 @@ private:
     float elapsedTime;
     float gameSpeed;
 
-    EngineTiming last_engine_timing;
 #ifdef WIN32
     std::unique_ptr<DynamicLibrary> exchndl;
 #endif
 #ifdef __EMSCRIPTEN__
     bool audio_started = false;
 #endif
-    std::vector<sp::ecs::System*> systems;
+    sp::ecs::SystemScheduler systems;
 public:
     Engine();
     ~Engine();
@@ -42,13 +42,16 @@ public:
     float getGameSpeed();
     float getElapsedTime();
     EngineTiming getEngineTiming();
+    //Time of every profiler zone that ran in the last frame, see sp::profiler::getLastFrame().
+    EngineTiming getProfilerTiming();
 
     void registerObject(string name, P<PObject> obj);
     P<PObject> getObject(string name);
 
     template<class T> void registerSystem() {
-        systems.push_back(new T());
+        systems.add(new T());
     }
+    sp::ecs::CommandBuffer& getCommandBuffer() { return systems.getCommandBuffer(); }
 
     void runMainLoop();
     void shutdown();
@@ -73,6 +73,12 @@ public:
     virtual float getBaseline(int pixel_size) = 0;
     virtual float getKerning(int previous_char_code, int current_char_code) = 0;
 
+    //Signed distance field fonts return distance values in the alpha channel of drawGlyph instead of coverage.
+    //A single rendered glyph can then be scaled to any size and still have sharp edges.
+    virtual bool isSignedDistanceField() { return false; }
+    //Amount of pixels drawGlyph adds around the glyph bounds on each side, in which the distance field fades out.
+    virtual int getGlyphPadding() { return 0; }
+
     virtual void setBaselineOffset(float offset) { baseline_offset = offset; }
     virtual float getBaselineOffset() const { return baseline_offset; }
 
@@ -8,10 +8,18 @@
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_GLYPH_H
+#include FT_MODULE_H
 #if defined(__GNUC__) && !defined(__clang__)
 //#pragma GCC diagnostic pop
 #endif//__GNUC__
 
+//The SDF renderer was added to freetype in 2.11, older system libraries can only render coverage bitmaps.
+#if FREETYPE_MAJOR > 2 || (FREETYPE_MAJOR == 2 && FREETYPE_MINOR >= 11)
+#define FREETYPE_HAS_SDF 1
+#endif
+//Distance in pixels the distance field extends outside of the glyph outline.
+static constexpr int sdf_spread = 4;
+
 static unsigned long ft_stream_read(FT_Stream rec, unsigned long offset, unsigned char* buffer, unsigned long count)
 {
     ResourceStream* stream = static_cast<ResourceStream*>(rec->descriptor.pointer);
@@ -32,7 +40,7 @@ void ft_stream_close(FT_Stream)
 
 namespace sp {
 
-FreetypeFont::FreetypeFont(const string& name, P<ResourceStream> stream)
+FreetypeFont::FreetypeFont(const string& name, P<ResourceStream> stream, bool signed_distance_field)
 {
     ft_library = nullptr;
     ft_face = nullptr;
@@ -80,6 +88,26 @@ FreetypeFont::FreetypeFont(const string& name, P<ResourceStream> stream)
         return;
     }
 
+    if (signed_distance_field)
+    {
+#ifdef FREETYPE_HAS_SDF
+        if (!FT_IS_SCALABLE(face))
+        {
+            LOG(Warning, "Font ", name, " is not scalable, cannot render it as signed distance field.");
+            signed_distance_field = false;
+        }
+        else
+        {
+            FT_Int spread = sdf_spread;
+            FT_Property_Set(library, "sdf", "spread", &spread);
+        }
+#else
+        LOG(Warning, "Freetype version too old for signed distance field rendering, rendering ", name, " as normal font.");
+        signed_distance_field = false;
+#endif
+    }
+
+    this->signed_distance_field = signed_distance_field;
     ft_library = library;
     ft_stream_rec = stream_rec;
     ft_face = face;
@@ -168,13 +196,21 @@ Image FreetypeFont::drawGlyph(int char_code, int pixel_size)
 {
     FT_Face face = static_cast<FT_Face>(ft_face);
     
+    if (face->size->metrics.x_ppem != pixel_size)
+        FT_Set_Pixel_Sizes(face, 0, pixel_size);
+
+    FT_Render_Mode render_mode = FT_RENDER_MODE_NORMAL;
+#ifdef FREETYPE_HAS_SDF
+    if (signed_distance_field)
+        render_mode = FT_RENDER_MODE_SDF;
+#endif
     int glyph_index = FT_Get_Char_Index(face, char_code);
     if (glyph_index != 0 && FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT) == 0)
     {
         FT_Glyph glyph;
         if (FT_Get_Glyph(face->glyph, &glyph) == 0)
         {
-            FT_Glyph_To_Bitmap(&glyph, FT_RENDER_MODE_NORMAL, 0, 1);
+            FT_Glyph_To_Bitmap(&glyph, render_mode, 0, 1);
             FT_Bitmap& bitmap = FT_BitmapGlyph(glyph)->bitmap;
             
             const uint8_t* src_pixels = bitmap.buffer;
@@ -206,6 +242,16 @@ Image FreetypeFont::drawGlyph(int char_code, int pixel_size)
     return image;
 }
 
+bool FreetypeFont::isSignedDistanceField()
+{
+    return signed_distance_field;
+}
+
+int FreetypeFont::getGlyphPadding()
+{
+    return signed_distance_field ? sdf_spread : 0;
+}
+
 float FreetypeFont::getLineSpacing(int pixel_size)
 {
     if (static_cast<FT_Face>(ft_face)->size->metrics.x_ppem != pixel_size)
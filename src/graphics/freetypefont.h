@@ -11,7 +11,7 @@ namespace sp {
 class FreetypeFont : public Font
 {
 public:
-    FreetypeFont(const string& name, P<ResourceStream> stream);
+    FreetypeFont(const string& name, P<ResourceStream> stream, bool signed_distance_field=false);
     ~FreetypeFont();
 
 protected:
@@ -21,11 +21,14 @@ protected:
     virtual float getLineSpacing(int pixel_size) override;
     virtual float getBaseline(int pixel_size) override;
     virtual float getKerning(int previous_char_code, int current_char_code) override;
+    virtual bool isSignedDistanceField() override;
+    virtual int getGlyphPadding() override;
 
 private:
     void* ft_library;
     void* ft_face;
     void* ft_stream_rec;
+    bool signed_distance_field = false;
     
     //We need to keep the resource stream open, as the freetype keeps it open as well.
     //So we store the reference here.
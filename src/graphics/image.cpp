@@ -108,5 +108,16 @@ bool Image::loadFromStream(P<ResourceStream> stream)
     return true;
 }
 
+bool Image::loadFromMemory(const void* data, size_t data_size)
+{
+    int x, y, channels;
+    glm::u8vec4* buffer = reinterpret_cast<glm::u8vec4*>(stbi_load_from_memory(static_cast<const stbi_uc*>(data), static_cast<int>(data_size), &x, &y, &channels, 4));
+    if (!buffer)
+        return false;
+    update({x, y}, buffer);
+    stbi_image_free(buffer);
+    return true;
+}
+
 
 }//namespace sp
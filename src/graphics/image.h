@@ -25,6 +25,8 @@ public:
     void update(glm::ivec2 size, const glm::u8vec4* ptr);
     void update(glm::ivec2 size, const glm::u8vec4* ptr, int pitch);
     bool loadFromStream(P<ResourceStream> stream);
+    //Decode an image file that is already in memory, this does not touch any PObject, so it is safe to call from a background thread.
+    bool loadFromMemory(const void* data, size_t size);
 
     glm::ivec2 getSize() const { return size; }
     const glm::u8vec4* getPtr() const { return pixels.data(); }
@@ -1,6 +1,12 @@
 #include "graphics/ktx2texture.h"
 
 #include <array>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <fstream>
+#include <filesystem>
+#include <thread>
 
 #if defined(__GNUC__) && !defined(__clang__)
 #pragma GCC diagnostic push
@@ -14,8 +20,38 @@
 
 #include "graphics/opengl.h"
 #include "graphics/texture.h"
+#include "logging.h"
 
 namespace {
+    // Transcoded data is stored in the cache directory, one file per source file content, target format and mip level.
+    string transcode_cache_directory;
+
+    // Increase when the cache file layout or the transcoder changes, so old cache files are ignored.
+    constexpr uint32_t transcode_cache_version = 1;
+
+    struct TranscodeCacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t source_hash;
+        uint64_t source_size;
+        uint32_t format;
+        uint32_t mip_level;
+        uint64_t data_size;
+    };
+
+    // FNV-1a, enough to identify the source file, the size and format are checked as well.
+    uint64_t contentHash(const std::vector<uint8_t>& data)
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for(auto b : data)
+        {
+            hash ^= b;
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
     constexpr GLenum basistFormatCast(basist::transcoder_texture_format format)
     {
         // https://github.com/BinomialLLC/basis_universal/wiki/OpenGL-texture-format-enums-table
@@ -69,11 +105,13 @@ namespace sp {
     public:
         static std::unique_ptr<Details> load(std::vector<uint8_t>&& data)
         {
-            if (!codebook)
+            // Textures can be loaded from multiple threads at the same time, so initialize only once.
+            static std::once_flag init_flag;
+            std::call_once(init_flag, []()
             {
                 basist::basisu_transcoder_init();
                 codebook = std::make_unique<basist::etc1_global_selector_codebook>(basist::g_global_selector_cb_size, basist::g_global_selector_cb);
-            }
+            });
 
             std::unique_ptr<Details> result{ new Details{} };
 
@@ -99,11 +137,7 @@ namespace sp {
             if (!transcoder.start_transcoding())
                 return {};
 
-            const auto block_or_pixel_size = basist::basis_get_bytes_per_block_or_pixel(target_format);
-            const auto is_uncompressed = basist::basis_transcoder_format_is_uncompressed(target_format);
-            auto total_blocks_or_pixels = is_uncompressed ? info.m_orig_width * info.m_orig_height : info.m_total_blocks;
-
-            std::vector<T> pixels_or_blocks(total_blocks_or_pixels * block_or_pixel_size / sizeof(T));
+            std::vector<T> pixels_or_blocks(transcodedSize(info, target_format) / sizeof(T));
 
             if (!transcoder.transcode_image_level(info.m_level_index, 0, 0, pixels_or_blocks.data(), static_cast<uint32_t>(pixels_or_blocks.size() * sizeof(T)), target_format))
                 return {};
@@ -111,6 +145,15 @@ namespace sp {
             return pixels_or_blocks;
         }
 
+        // Size in bytes of a mip level after transcoding it to the target format.
+        static size_t transcodedSize(const basist::ktx2_image_level_info& info, basist::transcoder_texture_format target_format)
+        {
+            const auto block_or_pixel_size = basist::basis_get_bytes_per_block_or_pixel(target_format);
+            const auto is_uncompressed = basist::basis_transcoder_format_is_uncompressed(target_format);
+            auto total_blocks_or_pixels = is_uncompressed ? info.m_orig_width * info.m_orig_height : info.m_total_blocks;
+            return size_t(total_blocks_or_pixels) * block_or_pixel_size;
+        }
+
         template<typename T>
         auto transcode(uint32_t mip_level)
         {
@@ -123,6 +166,69 @@ namespace sp {
         }
 
         basist::transcoder_texture_format getBestFormat() const { return best_format; }
+
+        // Transcode to the best format, using the transcode cache when it is enabled.
+        std::vector<uint8_t> transcodeCached(uint32_t mip_level)
+        {
+            if (transcode_cache_directory.empty())
+                return transcode<uint8_t>(mip_level);
+
+            if (!source_hash)
+                source_hash = contentHash(transcoding_data);
+            TranscodeCacheHeader header{{'S', 'P', 'T', 'C'}, transcode_cache_version, source_hash, transcoding_data.size(), static_cast<uint32_t>(best_format), mip_level, 0};
+            char filename[64];
+            snprintf(filename, sizeof(filename), "%016llx_%u_%u.bin", static_cast<unsigned long long>(source_hash), header.format, mip_level);
+            auto path = std::filesystem::u8path(transcode_cache_directory.c_str()) / filename;
+
+            std::ifstream input(path, std::ios::binary);
+            if (input)
+            {
+                // The data size has to be exactly what this mip level transcodes to, and the rest of the file,
+                //  so a damaged file cannot make us allocate more than the real transcode would.
+                basist::ktx2_image_level_info info;
+                std::error_code ec;
+                auto file_size = std::filesystem::file_size(path, ec);
+                TranscodeCacheHeader cached_header;
+                if (!ec && file_size >= sizeof(cached_header) && transcoder.get_image_level_info(info, mip_level, 0, 0)
+                    && input.read(reinterpret_cast<char*>(&cached_header), sizeof(cached_header))
+                    && memcmp(cached_header.magic, header.magic, sizeof(header.magic)) == 0 && cached_header.version == header.version
+                    && cached_header.source_hash == header.source_hash && cached_header.source_size == header.source_size
+                    && cached_header.format == header.format && cached_header.mip_level == header.mip_level
+                    && cached_header.data_size == file_size - sizeof(cached_header) && cached_header.data_size == transcodedSize(info, best_format))
+                {
+                    std::vector<uint8_t> result(cached_header.data_size);
+                    if (input.read(reinterpret_cast<char*>(result.data()), result.size()))
+                        return result;
+                }
+                LOG(Warning, "[ktx2]: ignoring invalid transcode cache file: ", path.u8string());
+            }
+
+            auto result = transcode<uint8_t>(mip_level);
+            if (result.empty())
+                return result;
+
+            // Write to a temporary file first, so other threads or processes never see a partial file.
+            std::error_code ec;
+            std::filesystem::create_directories(path.parent_path(), ec);
+            auto temp_path = path;
+            temp_path += "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+            header.data_size = result.size();
+            {
+                std::ofstream output(temp_path, std::ios::binary | std::ios::trunc);
+                output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                output.write(reinterpret_cast<const char*>(result.data()), result.size());
+                if (!output)
+                    ec = std::make_error_code(std::errc::io_error);
+            }
+            if (!ec)
+                std::filesystem::rename(temp_path, path, ec);
+            if (ec)
+            {
+                LOG(Warning, "[ktx2]: failed to write transcode cache file: ", path.u8string());
+                std::filesystem::remove(temp_path, ec);
+            }
+            return result;
+        }
         glm::ivec2 getSize(uint32_t mip_level) const
         {
             basist::ktx2_image_level_info info;
@@ -210,6 +316,7 @@ namespace sp {
 
         basist::ktx2_transcoder transcoder;
         std::vector<uint8_t> transcoding_data;
+        uint64_t source_hash = 0;
         basist::transcoder_texture_format best_format{ basist::transcoder_texture_format::cTFRGBA32 };
     };
 
@@ -222,6 +329,11 @@ namespace sp {
 
         std::vector<uint8_t> data(stream->getSize());
         stream->read(data.data(), data.size());
+        return loadFromMemory(std::move(data));
+    }
+
+    bool KTX2Texture::loadFromMemory(std::vector<uint8_t>&& data)
+    {
         details = Details::load(std::move(data));
 
         return details != nullptr;
@@ -255,7 +367,12 @@ namespace sp {
         if (!details)
             return {};
 
-        return details->transcode<uint8_t>(mip_level);
+        return details->transcodeCached(mip_level);
+    }
+
+    void KTX2Texture::setTranscodeCacheDirectory(const string& path)
+    {
+        transcode_cache_directory = path;
     }
 
     glm::ivec2 KTX2Texture::getSize(uint32_t mip_level) const
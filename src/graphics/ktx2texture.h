@@ -16,6 +16,8 @@ namespace sp {
     {
     public:
         bool loadFromStream(P<ResourceStream> stream);
+        // Does not touch any PObject, so this and the transcode functions are safe to use from a background thread.
+        bool loadFromMemory(std::vector<uint8_t>&& data);
 
         std::optional<Image> toImage(uint32_t mip_level = 0);
         std::unique_ptr<BasicTexture> toTexture(uint32_t mip_level = 0);
@@ -26,6 +28,11 @@ namespace sp {
         uint32_t getNativeFormat() const;
         uint32_t getMipCount() const;
 
+        // Store the result of transcoding to the native GPU format in this directory, so the next run can skip transcoding.
+        // Cache files are keyed on the content of the source file, the target format and the mip level. Empty disables the cache.
+        // Set this at startup, before any texture is loaded.
+        static void setTranscodeCacheDirectory(const string& path);
+
         KTX2Texture();
         ~KTX2Texture();
 
@@ -3,6 +3,7 @@
 #include "textureManager.h"
 #include "windowManager.h"
 #include "engine.h"
+#include "profiler.h"
 
 #include "graphics/ktx2texture.h"
 #include "graphics/opengl.h"
@@ -10,6 +11,9 @@
 #include "vectorUtils.h"
 #include <glm/gtc/type_ptr.hpp>
 #include <variant>
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
 
 #include <SDL_assert.h>
 
@@ -37,41 +41,196 @@ struct ImageInfo
     Texture* texture;
     glm::ivec2 size;
     Rect uv_rect;
+    unsigned int last_used_frame;
+};
+struct AtlasGlyph
+{
+    Rect uv_rect;
+    glm::ivec2 size;
+    unsigned int last_used_frame;
 };
 static sp::AtlasTexture* atlas_texture;
 static std::unordered_map<string, ImageInfo> image_info;
-static std::unordered_map<sp::Font*, std::unordered_map<int, Rect>> atlas_glyphs;
-static constexpr glm::ivec2 atlas_size = {2048, 2048};
-static constexpr glm::vec2 atlas_white_pixel = {(float(atlas_size.x)-0.5f)/float(atlas_size.x), (float(atlas_size.y)-0.5f)/float(atlas_size.y)};
+static std::unordered_map<sp::Font*, std::unordered_map<int, AtlasGlyph>> atlas_glyphs;
+static constexpr glm::ivec2 atlas_initial_size = {2048, 2048};
+static constexpr int atlas_size_limit = 8192;
+static int atlas_max_size = atlas_initial_size.x;
+static glm::vec2 atlas_white_pixel;
+//Entries that have been used in this amount of recent frames are the working set of the atlas, and will be added again after a rebuild.
+static constexpr unsigned int atlas_working_set_frames = 60;
+//Every this amount of frames, check if the atlas is filled with mostly unused entries, and rebuild it if so.
+static constexpr unsigned int atlas_repack_interval = 600;
+static unsigned int frame_number = 0;
+//Starts a full interval back, so the first rebuild is never held back.
+static unsigned int atlas_last_rebuild_frame = 0u - atlas_repack_interval;
+static bool atlas_rebuild_requested = false;
+//Images larger then this get their own texture instead of being put in the atlas.
+static constexpr glm::ivec2 atlas_threshold{ 128, 128 };
+//Images that are being loaded in the background.
+static std::unordered_set<string> pending_images;
+
+
+static int getAtlasWorkingSetArea()
+{
+    int area = 0;
+    for(auto& it : image_info)
+        if (!it.second.texture && frame_number - it.second.last_used_frame < atlas_working_set_frames)
+            area += (it.second.size.x + 2) * (it.second.size.y + 2);
+    for(auto& font_glyphs : atlas_glyphs)
+        for(auto& it : font_glyphs.second)
+            if (frame_number - it.second.last_used_frame < atlas_working_set_frames)
+                area += (it.second.size.x + 2) * (it.second.size.y + 2);
+    return area;
+}
 
+//Clear the atlas, and move the working set into it again from the old texture, so those images are not decoded again and do not
+//  go missing for a frame. Entries that are no longer used are evicted, and will be loaded again when they are used.
+//This can only be done when there is no pending vertex data that refers to the atlas, so at the start of a frame.
+static void rebuildAtlas()
+{
+    auto size = atlas_texture->getSize();
+    auto working_set_area = getAtlasWorkingSetArea();
+    //If the recently used entries fill more then half of the atlas, they would not fit well after a rebuild, so grow the atlas.
+    if (working_set_area * 2 > size.x * size.y)
+    {
+        if (size.x * 2 <= atlas_max_size && size.y * 2 <= atlas_max_size)
+            size *= 2;
+        else
+            LOG(Warning, "Texture atlas is too small for the images in use, and cannot grow beyond ", atlas_max_size);
+    }
+    LOG(Info, "Rebuilding texture atlas: ", atlas_texture->getImageCount(), " images, ", atlas_texture->usageRate() * 100.0f, "% used, ",
+        atlas_texture->wasteRate() * 100.0f, "% wasted, ", float(working_set_area) * 100.0f / float(atlas_texture->getSize().x * atlas_texture->getSize().y), "% in use, new size: ", size);
 
-static ImageInfo getTextureInfo(std::string_view texture)
+    Image old_pixels;
+    bool keep_working_set = atlas_texture->download(old_pixels);
+    auto old_size = atlas_texture->getSize();
+    atlas_texture->clear(size);
+    atlas_white_pixel = atlas_texture->getWhitePixel();
+
+    //Entries are added tallest first, which packs well with the skyline allocator.
+    struct Move
+    {
+        Rect* uv_rect;
+        glm::ivec2 size;
+    };
+    std::vector<Move> moves;
+    for(auto it = image_info.begin(); it != image_info.end(); )
+    {
+        if (it->second.texture)
+            ++it;
+        else if (keep_working_set && frame_number - it->second.last_used_frame < atlas_working_set_frames)
+        {
+            moves.push_back({&it->second.uv_rect, it->second.size});
+            ++it;
+        }
+        else
+            it = image_info.erase(it);
+    }
+    for(auto& font_glyphs : atlas_glyphs)
+    {
+        for(auto it = font_glyphs.second.begin(); it != font_glyphs.second.end(); )
+        {
+            if (keep_working_set && frame_number - it->second.last_used_frame < atlas_working_set_frames)
+            {
+                moves.push_back({&it->second.uv_rect, it->second.size});
+                ++it;
+            }
+            else
+                it = font_glyphs.second.erase(it);
+        }
+    }
+    std::sort(moves.begin(), moves.end(), [](const Move& a, const Move& b) { return a.size.y > b.size.y; });
+    for(auto& move : moves)
+    {
+        glm::ivec2 position{int(std::round(move.uv_rect->position.x * float(old_size.x))), int(std::round(move.uv_rect->position.y * float(old_size.y)))};
+        Image image;
+        image.update(move.size, old_pixels.getPtr() + position.x + position.y * old_size.x, old_size.x);
+        *move.uv_rect = atlas_texture->add(std::move(image), 1);
+    }
+    //What did not fit is dropped, and loaded again when it is used.
+    for(auto it = image_info.begin(); it != image_info.end(); )
+    {
+        if (!it->second.texture && it->second.uv_rect.size.x < 0.0f)
+            it = image_info.erase(it);
+        else
+            ++it;
+    }
+    for(auto& font_glyphs : atlas_glyphs)
+    {
+        for(auto it = font_glyphs.second.begin(); it != font_glyphs.second.end(); )
+        {
+            if (it->second.uv_rect.size.x < 0.0f)
+                it = font_glyphs.second.erase(it);
+            else
+                ++it;
+        }
+    }
+    atlas_rebuild_requested = false;
+    atlas_last_rebuild_frame = frame_number;
+}
+
+//A full atlas that can still grow is rebuilt right away. Once it is at the maximum size, rebuilding cannot make the working set fit,
+//  so it is only rebuilt once per repack interval to evict the entries that are no longer used.
+static bool canRebuildAtlas()
 {
-    auto it = image_info.find(texture);
-    if (it != image_info.end())
-        return it->second;
+    auto size = atlas_texture->getSize();
+    if (size.x * 2 <= atlas_max_size && size.y * 2 <= atlas_max_size)
+        return true;
+    return frame_number - atlas_last_rebuild_frame >= atlas_repack_interval;
+}
 
-    P<ResourceStream> stream;
-    // filename variants:
-    //  name
-    //  name.notanextension
-    //  name.ext
-    //  name.notanext.ext
-    // Attempt to load the best version.
-    auto last_dot = texture.find_last_of('.');
-    if (last_dot != std::string::npos)
+//Add an image to the atlas, returns a negative size if the atlas is full. When the atlas can be rebuild, it will be on the next frame.
+static Rect addToAtlas(Image&& image)
+{
+    Rect uv_rect = atlas_texture->add(std::move(image), 1);
+    if (uv_rect.size.x < 0.0f && canRebuildAtlas())
+        atlas_rebuild_requested = true;
+    return uv_rect;
+}
+
+static void createAtlas()
+{
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &atlas_max_size);
+    atlas_max_size = std::clamp(atlas_max_size, atlas_initial_size.x, atlas_size_limit);
+    atlas_texture = new AtlasTexture(atlas_initial_size);
+    atlas_white_pixel = atlas_texture->getWhitePixel();
+}
+
+//Store a decoded image, large images get their own texture, small ones are put in the atlas.
+static ImageInfo storeImage(std::string_view texture, Image&& image)
+{
+    auto size = image.getSize();
+    if (size.x > atlas_threshold.x || size.y > atlas_threshold.y)
     {
-        // Extension found, try and substitute it.
-        stream = getResourceStream(string(texture.substr(0, static_cast<uint32_t>(last_dot))) + ".ktx2");
+        LOG(Info, "Loaded ", string(texture));
+        auto gltexture = new sp::BasicTexture(image);
+        image_info[texture] = {gltexture, size, {0.0f, 0.0f, 1.0f, 1.0f}, frame_number};
+        return {gltexture, size, {0.0f, 0.0f, 1.0f, 1.0f}, frame_number};
     }
 
-    if (!stream)
+    Rect uv_rect = addToAtlas(std::move(image));
+    if (uv_rect.size.x < 0.0f)
     {
-        // No extension, or substitution failed (maybe it wasn't an extension), blindly add it.
-        stream = getResourceStream(string(texture) + ".ktx2");
+        if (atlas_rebuild_requested)
+        {
+            //Atlas is full, draw nothing and do not store this, so we try again after the atlas is rebuild.
+            return {nullptr, size, {atlas_texture->getTransparentPixel(), {0.0f, 0.0f}}, frame_number};
+        }
+        //Atlas is full and cannot be rebuild yet, the image gets its own texture instead. The failed add left the image untouched.
+        LOG(Info, "Loaded ", string(texture), " outside of the full atlas");
+        auto gltexture = new sp::BasicTexture(image);
+        image_info[texture] = {gltexture, size, {0.0f, 0.0f, 1.0f, 1.0f}, frame_number};
+        return {gltexture, size, {0.0f, 0.0f, 1.0f, 1.0f}, frame_number};
     }
+    image_info[texture] = {nullptr, size, uv_rect, frame_number};
+    LOG(Info, "Added ", string(texture), " to atlas@", uv_rect.position, " ", uv_rect.size, "  ", atlas_texture->usageRate() * 100.0f, "%");
+    return {nullptr, size, uv_rect, frame_number};
+}
+
+static ImageInfo loadTextureInfo(std::string_view texture)
+{
+    P<ResourceStream> stream = TextureManager::openKTX2Stream(texture);
 
-    constexpr glm::ivec2 atlas_threshold{ 128, 128 };
     KTX2Texture ktxtexture;
     Image image;
     if (stream)
@@ -87,8 +246,8 @@ static ImageInfo getTextureInfo(std::string_view texture)
                 if (gltexture)
                 {
                     LOG(Info, "Loaded ", texture.data(), " (ktx2)");
-                    image_info[texture] = { gltexture.get(), size, {0.0f, 0.0f, 1.0f, 1.0f} };
-                    return { gltexture.release(), size, {0.0f, 0.0f, 1.0f, 1.0f} };
+                    image_info[texture] = { gltexture.get(), size, {0.0f, 0.0f, 1.0f, 1.0f}, frame_number };
+                    return { gltexture.release(), size, {0.0f, 0.0f, 1.0f, 1.0f}, frame_number };
                 }
                 else
                 {
@@ -112,26 +271,134 @@ static ImageInfo getTextureInfo(std::string_view texture)
     }
 
     if (!stream)
+        image.loadFromStream(TextureManager::openImageStream(texture));
+
+    return storeImage(texture, std::move(image));
+}
+
+//Decodes an image on a background thread, with the same rules as loadTextureInfo.
+class ImageLoadJob : public TextureManager::BackgroundJob
+{
+public:
+    ImageLoadJob(std::string_view name, std::vector<uint8_t>&& data, bool is_ktx2, uint32_t base_mip_level)
+    : name(name), data(std::move(data)), is_ktx2(is_ktx2), base_mip_level(base_mip_level)
     {
-        stream = getResourceStream(texture);
-        if (!stream)
-            stream = getResourceStream(string(texture) + ".png");
-        image.loadFromStream(stream);
     }
-    
-    auto size = image.getSize();
-    if (size.x > atlas_threshold.x || size.y > atlas_threshold.y)
+
+    virtual void decode() override
     {
-        LOG(Info, "Loaded ", string(texture));
-        auto gltexture = new sp::BasicTexture(image);
-        image_info[texture] = {gltexture, size, {0.0f, 0.0f, 1.0f, 1.0f}};
-        return {gltexture, size, {0.0f, 0.0f, 1.0f, 1.0f}};
+        if (is_ktx2)
+        {
+            KTX2Texture ktxtexture;
+            if (ktxtexture.loadFromMemory(std::move(data)))
+            {
+                auto size = ktxtexture.getSize();
+                if (size.x > atlas_threshold.x || size.y > atlas_threshold.y)
+                {
+                    auto mip_level = std::min(base_mip_level, ktxtexture.getMipCount() - 1);
+                    native_size = ktxtexture.getSize(mip_level);
+                    native_texture_size = ktxtexture.getNativeSize(mip_level);
+                    native_format = ktxtexture.getNativeFormat();
+                    native_pixels = ktxtexture.toNative(mip_level);
+                }
+                else if (auto to_image = ktxtexture.toImage(); to_image.has_value())
+                {
+                    image = std::move(to_image.value());
+                }
+            }
+        }
+        else
+        {
+            image.loadFromMemory(data.data(), data.size());
+        }
+        data.clear();
     }
 
-    Rect uv_rect = atlas_texture->add(std::move(image), 1);
-    image_info[texture] = {nullptr, size, uv_rect};
-    LOG(Info, "Added ", string(texture), " to atlas@", uv_rect.position, " ", uv_rect.size, "  ", atlas_texture->usageRate() * 100.0f, "%");
-    return {nullptr, size, uv_rect};
+    virtual void finish() override
+    {
+        pending_images.erase(name);
+        if (image_info.find(name) != image_info.end())
+            return;
+        if (!atlas_texture)
+            createAtlas();
+
+        if (!native_pixels.empty())
+        {
+            LOG(Info, "Loaded ", name, " (ktx2)");
+            auto gltexture = new sp::BasicTexture(native_texture_size, native_pixels, native_format);
+            image_info[name] = { gltexture, native_size, {0.0f, 0.0f, 1.0f, 1.0f}, frame_number };
+        }
+        else if (is_ktx2 && image.getSize().x == 0)
+        {
+            //Decoding the ktx2 file failed, let the normal loading report the problem and fallback on the image.
+            loadTextureInfo(name);
+        }
+        else
+        {
+            storeImage(name, std::move(image));
+        }
+    }
+
+private:
+    string name;
+    std::vector<uint8_t> data;
+    bool is_ktx2;
+    uint32_t base_mip_level;
+
+    Image image;
+    std::vector<uint8_t> native_pixels;
+    glm::ivec2 native_size;
+    glm::ivec2 native_texture_size;
+    uint32_t native_format = 0;
+};
+
+static void queueImageLoad(std::string_view texture)
+{
+    if (pending_images.find(texture) != pending_images.end())
+        return;
+    //Streams are found and read on the main thread, only the decoding is done in the background.
+    bool is_ktx2 = true;
+    auto stream = TextureManager::openKTX2Stream(texture);
+    if (!stream)
+    {
+        is_ktx2 = false;
+        stream = TextureManager::openImageStream(texture);
+    }
+    std::vector<uint8_t> data;
+    if (stream)
+    {
+        data.resize(stream->getSize());
+        stream->read(data.data(), data.size());
+    }
+    pending_images.emplace(texture);
+    textureManager.queueBackgroundJob(std::make_unique<ImageLoadJob>(texture, std::move(data), is_ktx2, textureManager.getBaseMipLevel()));
+}
+
+static ImageInfo getTextureInfo(std::string_view texture)
+{
+    auto it = image_info.find(texture);
+    if (it != image_info.end())
+    {
+        it->second.last_used_frame = frame_number;
+        return it->second;
+    }
+
+    if (textureManager.isBackgroundLoading())
+    {
+        //Draw nothing till the image is loaded.
+        queueImageLoad(texture);
+        return {nullptr, {1, 1}, {atlas_texture->getTransparentPixel(), {0.0f, 0.0f}}, frame_number};
+    }
+    return loadTextureInfo(texture);
+}
+
+//Smoothing range for the signed distance field shader, so the edge of a glyph is anti-aliased over roughly one physical pixel.
+//Alpha 0.5 is the glyph outline, and the distance field goes from 0.0 to 1.0 over twice the glyph padding.
+static float getSDFSmoothing(sp::Font* font, float size_scale, float pixel_scale)
+{
+    if (!font->isSignedDistanceField() || font->getGlyphPadding() < 1)
+        return 0.0f;
+    return std::min(0.5f, 0.25f / (float(font->getGlyphPadding()) * size_scale * pixel_scale));
 }
 
 RenderTarget::RenderTarget(glm::vec2 virtual_size, glm::ivec2 physical_size)
@@ -145,14 +412,17 @@ uniform mat3 u_projection;
 attribute vec2 a_position;
 attribute vec2 a_texcoords;
 attribute vec4 a_color;
+attribute float a_sdf_smoothing;
 
 varying vec2 v_texcoords;
 varying vec4 v_color;
+varying float v_sdf_smoothing;
 
 void main()
 {
     v_texcoords = a_texcoords;
     v_color = a_color;
+    v_sdf_smoothing = a_sdf_smoothing;
     gl_Position = vec4(u_projection * vec3(a_position, 1.0), 1.0);
 }
 
@@ -161,10 +431,14 @@ uniform sampler2D u_texture;
 
 varying vec2 v_texcoords;
 varying vec4 v_color;
+varying float v_sdf_smoothing;
 
 void main()
 {
-    gl_FragColor = texture2D(u_texture, v_texcoords) * v_color;
+    vec4 color = texture2D(u_texture, v_texcoords);
+    if (v_sdf_smoothing > 0.0)
+        color.a = smoothstep(0.5 - v_sdf_smoothing, 0.5 + v_sdf_smoothing, color.a);
+    gl_FragColor = color * v_color;
 }
 )");
     if (!vertices_vbo)
@@ -185,7 +459,23 @@ void main()
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     if (!atlas_texture)
-        atlas_texture = new AtlasTexture(atlas_size);
+        createAtlas();
+
+    if (atlas_rebuild_requested)
+        rebuildAtlas();
+}
+
+void RenderTarget::beginFrame()
+{
+    frame_number++;
+    if (atlas_texture && !atlas_rebuild_requested && frame_number % atlas_repack_interval == 0)
+    {
+        //When most of the atlas is taken up by entries that are no longer used, rebuild it before it runs full.
+        auto size = atlas_texture->getSize();
+        auto unavailable_area = (atlas_texture->usageRate() + atlas_texture->wasteRate()) * float(size.x * size.y);
+        if (unavailable_area > float(size.x * size.y) * 0.75f && float(getAtlasWorkingSetArea()) < unavailable_area * 0.5f)
+            atlas_rebuild_requested = true;
+    }
 }
 
 void RenderTarget::setDefaultFont(sp::Font* font)
@@ -198,6 +488,13 @@ sp::Font* RenderTarget::getDefaultFont()
     return default_font;
 }
 
+void RenderTarget::prefetch(const std::vector<string>& textures)
+{
+    for(const auto& texture : textures)
+        if (image_info.find(texture) == image_info.end())
+            queueImageLoad(texture);
+}
+
 void RenderTarget::drawSprite(std::string_view texture, glm::vec2 center, float size, glm::u8vec4 color)
 {
     auto info = getTextureInfo(texture);
@@ -717,6 +1014,8 @@ void RenderTarget::drawText(sp::Rect rect, std::string_view text, Alignment alig
 void RenderTarget::drawText(sp::Rect rect, const sp::Font::PreparedFontString& prepared, int flags)
 {
     auto& ags = atlas_glyphs[prepared.getFont()];
+    float padding = float(prepared.getFont()->getGlyphPadding());
+    float pixel_scale = float(physical_size.y) / virtual_size.y;
     for(auto gd : prepared.data)
     {
         Font::GlyphInfo glyph;
@@ -732,26 +1031,32 @@ void RenderTarget::drawText(sp::Rect rect, const sp::Font::PreparedFontString& p
             auto it = ags.find(gd.char_code);
             if (it == ags.end())
             {
-                uv_rect = atlas_texture->add(prepared.getFont()->drawGlyph(gd.char_code, 32), 1);
-                ags[gd.char_code] = uv_rect;
+                auto glyph_image = prepared.getFont()->drawGlyph(gd.char_code, 32);
+                auto glyph_size = glyph_image.getSize();
+                uv_rect = addToAtlas(std::move(glyph_image));
+                if (uv_rect.size.x < 0.0f)
+                    continue;
+                ags[gd.char_code] = {uv_rect, glyph_size, frame_number};
                 //LOG(Info, "Added glyph '", char(gd.char_code), "' to atlas@", uv_rect.position, " ", uv_rect.size, "  ", atlas_texture->usageRate() * 100.0f, "%");
             }
             else
             {
-                uv_rect = it->second;
+                it->second.last_used_frame = frame_number;
+                uv_rect = it->second.uv_rect;
             }
             float size_scale = gd.size / 32.0f;
+            float sdf_smoothing = getSDFSmoothing(prepared.getFont(), size_scale, pixel_scale);
 
             float u0 = uv_rect.position.x;
             float v0 = uv_rect.position.y;
             float u1 = uv_rect.position.x + uv_rect.size.x;
             float v1 = uv_rect.position.y + uv_rect.size.y;
 
-            float left = gd.position.x + glyph.bounds.position.x * size_scale;
-            float right = left + glyph.bounds.size.x * size_scale;
+            float left = gd.position.x + (glyph.bounds.position.x - padding) * size_scale;
+            float right = left + (glyph.bounds.size.x + padding * 2.0f) * size_scale;
             // Adjust font baseline if set.
-            float top = gd.position.y - glyph.bounds.position.y * size_scale + (prepared.getFont()->getBaselineOffset() * gd.size / 32.0f);
-            float bottom = top + glyph.bounds.size.y * size_scale;
+            float top = gd.position.y - (glyph.bounds.position.y + padding) * size_scale + (prepared.getFont()->getBaselineOffset() * gd.size / 32.0f);
+            float bottom = top + (glyph.bounds.size.y + padding * 2.0f) * size_scale;
 
             if (flags & Font::FlagClip)
             {
@@ -815,13 +1120,13 @@ void RenderTarget::drawText(sp::Rect rect, const sp::Font::PreparedFontString& p
                 uint16_t(n + 1), uint16_t(n + 3), uint16_t(n + 2),
             });
             vertex_data.push_back({
-                p0, gd.color, {u0, v0}});
+                p0, gd.color, {u0, v0}, sdf_smoothing});
             vertex_data.push_back({
-                p2, gd.color, {u0, v1}});
+                p2, gd.color, {u0, v1}, sdf_smoothing});
             vertex_data.push_back({
-                p1, gd.color, {u1, v0}});
+                p1, gd.color, {u1, v0}, sdf_smoothing});
             vertex_data.push_back({
-                p3, gd.color, {u1, v1}});
+                p3, gd.color, {u1, v1}, sdf_smoothing});
         }
     }
 }
@@ -838,6 +1143,8 @@ void RenderTarget::drawRotatedText(glm::vec2 center, float rotation, std::string
 
     auto& ags = atlas_glyphs[prepared.getFont()];
     float size_scale = font_size / 32.0f;
+    float padding = float(prepared.getFont()->getGlyphPadding());
+    float sdf_smoothing = getSDFSmoothing(prepared.getFont(), size_scale, float(physical_size.y) / virtual_size.y);
     for(auto gd : prepared.data)
     {
         Font::GlyphInfo glyph;
@@ -853,13 +1160,18 @@ void RenderTarget::drawRotatedText(glm::vec2 center, float rotation, std::string
             auto it = ags.find(gd.char_code);
             if (it == ags.end())
             {
-                uv_rect = atlas_texture->add(prepared.getFont()->drawGlyph(gd.char_code, 32), 1);
-                ags[gd.char_code] = uv_rect;
+                auto glyph_image = prepared.getFont()->drawGlyph(gd.char_code, 32);
+                auto glyph_size = glyph_image.getSize();
+                uv_rect = addToAtlas(std::move(glyph_image));
+                if (uv_rect.size.x < 0.0f)
+                    continue;
+                ags[gd.char_code] = {uv_rect, glyph_size, frame_number};
                 LOG(Info, "Added glyph '", char(gd.char_code), "' to atlas@", uv_rect.position, " ", uv_rect.size, "  ", atlas_texture->usageRate() * 100.0f, "%");
             }
             else
             {
-                uv_rect = it->second;
+                it->second.last_used_frame = frame_number;
+                uv_rect = it->second.uv_rect;
             }
 
             float u0 = uv_rect.position.x;
@@ -867,11 +1179,11 @@ void RenderTarget::drawRotatedText(glm::vec2 center, float rotation, std::string
             float u1 = uv_rect.position.x + uv_rect.size.x;
             float v1 = uv_rect.position.y + uv_rect.size.y;
 
-            float left = gd.position.x + glyph.bounds.position.x * size_scale;
-            float right = left + glyph.bounds.size.x * size_scale;
+            float left = gd.position.x + (glyph.bounds.position.x - padding) * size_scale;
+            float right = left + (glyph.bounds.size.x + padding * 2.0f) * size_scale;
             // Adjust font baseline if set.
-            float top = gd.position.y - glyph.bounds.position.y * size_scale + (prepared.getFont()->getBaselineOffset() * gd.size / 32.0f);
-            float bottom = top + glyph.bounds.size.y * size_scale;
+            float top = gd.position.y - (glyph.bounds.position.y + padding) * size_scale + (prepared.getFont()->getBaselineOffset() * gd.size / 32.0f);
+            float bottom = top + (glyph.bounds.size.y + padding * 2.0f) * size_scale;
 
             glm::vec2 p0 = mat * glm::vec2{left, top} + center;
             glm::vec2 p1 = mat * glm::vec2{right, top} + center;
@@ -887,13 +1199,13 @@ void RenderTarget::drawRotatedText(glm::vec2 center, float rotation, std::string
                 uint16_t(n + 1), uint16_t(n + 3), uint16_t(n + 2),
             });
             vertex_data.push_back({
-                p0, color, {u0, v0}});
+                p0, color, {u0, v0}, sdf_smoothing});
             vertex_data.push_back({
-                p2, color, {u0, v1}});
+                p2, color, {u0, v1}, sdf_smoothing});
             vertex_data.push_back({
-                p1, color, {u1, v0}});
+                p1, color, {u1, v0}, sdf_smoothing});
             vertex_data.push_back({
-                p3, color, {u1, v1}});
+                p3, color, {u1, v1}, sdf_smoothing});
         }
     }
 }
@@ -1245,6 +1557,8 @@ void RenderTarget::applyBuffer(sp::Texture* texture, std::vector<VertexData> &da
         glEnableVertexAttribArray(shader->getAttributeLocation("a_color"));
         glVertexAttribPointer(shader->getAttributeLocation("a_texcoords"), 2, GL_FLOAT, GL_FALSE, static_cast<GLsizei>(sizeof(VertexData)), (void*)offsetof(VertexData, uv));
         glEnableVertexAttribArray(shader->getAttributeLocation("a_texcoords"));
+        glVertexAttribPointer(shader->getAttributeLocation("a_sdf_smoothing"), 1, GL_FLOAT, GL_FALSE, static_cast<GLsizei>(sizeof(VertexData)), (void*)offsetof(VertexData, sdf_smoothing));
+        glEnableVertexAttribArray(shader->getAttributeLocation("a_sdf_smoothing"));
 
         glDrawElements(mode, static_cast<GLsizei>(index.size()), GL_UNSIGNED_SHORT, nullptr);
 
@@ -1255,7 +1569,7 @@ void RenderTarget::applyBuffer(sp::Texture* texture, std::vector<VertexData> &da
 
 void RenderTarget::finish(sp::Texture* texture)
 {
-    
+    SP_PROFILE_ZONE("gl_flush");
     applyBuffer(texture, vertex_data, index_data, GL_TRIANGLES);
     applyBuffer(texture, lines_vertex_data, lines_index_data, GL_LINES);
     applyBuffer(texture, points_vertex_data, points_index_data, GL_POINTS);
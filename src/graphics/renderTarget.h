@@ -25,6 +25,10 @@ private:
 public:
     static void setDefaultFont(sp::Font* font);
     static sp::Font* getDefaultFont();
+    //Start loading these images in the background, so they are ready when they are drawn.
+    static void prefetch(const std::vector<string>& textures);
+    //Called by the engine once per frame, before any window is rendered. Counts the frames that decide which atlas entries are still in use.
+    static void beginFrame();
 
     void drawSprite(std::string_view texture, glm::vec2 center, float size, glm::u8vec4 color={255,255,255,255});
     void drawSpriteClipped(std::string_view texture, glm::vec2 center, float size, sp::Rect clip_rect, glm::u8vec4 color={255,255,255,255});
@@ -77,6 +81,8 @@ public:
         glm::vec2 position;
         glm::u8vec4 color;
         glm::vec2 uv;
+        //When above zero, the texture alpha is a signed distance field, and this is the smoothing range around the edge.
+        float sdf_smoothing = 0.0f;
     };
 
     void applyBuffer(sp::Texture* texture, std::vector<VertexData> &data, std::vector<uint16_t> &index, int mode);
@@ -2,16 +2,16 @@
 #include "graphics/opengl.h"
 #include "textureManager.h"
 #include <algorithm>
+#include <limits>
 
 
 namespace sp {
 
 AtlasTexture::AtlasTexture(glm::ivec2 size)
 {
-    texture_size = size;
-    available_areas.push_back({{0, 0}, {size.x, size.y}});
     gl_handle = 0;
     smooth = textureManager.isDefaultSmoothFiltering();
+    clear(size);
 }
 
 AtlasTexture::~AtlasTexture()
@@ -54,75 +54,157 @@ void AtlasTexture::bind()
 
 bool AtlasTexture::canAdd(const Image& image, int margin)
 {
-    glm::ivec2 size = image.getSize() + glm::ivec2(margin * 2, margin * 2);
-    for(int n=int(available_areas.size()) - 1; n >= 0; n--)
-    {
-        if (available_areas[n].size.x >= size.x && available_areas[n].size.y >= size.y)
-            return true;
-    }
-    return false;
+    glm::ivec2 position;
+    size_t node_index;
+    return findPosition(image.getSize() + glm::ivec2(margin * 2, margin * 2), position, node_index);
 }
 
 Rect AtlasTexture::add(Image&& image, int margin)
 {
     glm::ivec2 size = image.getSize() + glm::ivec2(margin * 2, margin * 2);
-    for(int n=int(available_areas.size()) - 1; n >= 0; n--)
+    glm::ivec2 position;
+    size_t node_index;
+    if (!findPosition(size, position, node_index))
+        return Rect(0, 0, -1, -1);
+
+    //Raise the skyline over the width of the new area, everything below the new area that was not used yet is lost.
+    int right = position.x + size.x;
+    for(size_t n=node_index; n<skyline.size() && skyline[n].x < right; n++)
+    {
+        int covered = std::min(right, skyline[n].x + skyline[n].width) - skyline[n].x;
+        waste_area += (position.y - skyline[n].y) * covered;
+    }
+    skyline.insert(skyline.begin() + node_index, {position.x, position.y + size.y, size.x});
+    for(size_t n=node_index + 1; n<skyline.size(); )
     {
-        if (available_areas[n].size.x >= size.x && available_areas[n].size.y >= size.y)
+        if (skyline[n].x >= right)
+            break;
+        int shrink = right - skyline[n].x;
+        skyline[n].x += shrink;
+        skyline[n].width -= shrink;
+        if (skyline[n].width > 0)
+            break;
+        skyline.erase(skyline.begin() + n);
+    }
+    for(size_t n=0; n + 1<skyline.size(); )
+    {
+        if (skyline[n].y == skyline[n + 1].y)
         {
-            //Suitable area found, grab it, cut it, and put it in a stew.
-            RectInt full_area = available_areas[n];
-            available_areas.erase(available_areas.begin() + n);
-            
-            if (full_area.size.x <= full_area.size.y)
-            {
-                //Split horizontal
-                addArea({{full_area.position.x + size.x, full_area.position.y}, {full_area.size.x - size.x, size.y}});
-                addArea({{full_area.position.x, full_area.position.y + size.y}, {full_area.size.x, full_area.size.y - size.y}});
-            }
-            else
-            {
-                //Split vertical
-                addArea({{full_area.position.x + size.x, full_area.position.y}, {full_area.size.x - size.x, full_area.size.y}});
-                addArea({{full_area.position.x, full_area.position.y + size.y}, {size.x, full_area.size.y - size.y}});
-            }
-            
-            if (image.getSize().x > 0 && image.getSize().y > 0)
-            {
-                add_list.emplace_back();
-                add_list.back().image = std::move(image);
-                add_list.back().position.x = full_area.position.x + margin;
-                add_list.back().position.y = full_area.position.y + margin;
-            }
-
-            return Rect(
-                float(full_area.position.x + margin) / float(texture_size.x), float(full_area.position.y + margin) / float(texture_size.y),
-                float(size.x - margin * 2) / float(texture_size.x), float(size.y - margin * 2) / float(texture_size.y));
+            skyline[n].width += skyline[n + 1].width;
+            skyline.erase(skyline.begin() + n + 1);
         }
+        else
+        {
+            n++;
+        }
+    }
+    used_area += size.x * size.y;
+    image_count += 1;
+
+    if (image.getSize().x > 0 && image.getSize().y > 0)
+    {
+        add_list.emplace_back();
+        add_list.back().image = std::move(image);
+        add_list.back().position.x = position.x + margin;
+        add_list.back().position.y = position.y + margin;
     }
-    return Rect(0, 0, -1, -1);
+
+    return Rect(
+        float(position.x + margin) / float(texture_size.x), float(position.y + margin) / float(texture_size.y),
+        float(size.x - margin * 2) / float(texture_size.x), float(size.y - margin * 2) / float(texture_size.y));
+}
+
+bool AtlasTexture::download(Image& image)
+{
+    if (!glad_glGenFramebuffers)
+        return false;
+    bind();
+
+    GLint previous_framebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous_framebuffer);
+    unsigned int frame_buffer;
+    glGenFramebuffers(1, &frame_buffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, frame_buffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gl_handle, 0);
+    bool result = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    if (result)
+    {
+        std::vector<glm::u8vec4> pixels(texture_size.x * texture_size.y);
+        glReadPixels(0, 0, texture_size.x, texture_size.y, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        image = Image(texture_size, std::move(pixels));
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer);
+    glDeleteFramebuffers(1, &frame_buffer);
+    return result;
+}
+
+void AtlasTexture::clear()
+{
+    clear(texture_size);
+}
+
+void AtlasTexture::clear(glm::ivec2 new_size)
+{
+    texture_size = new_size;
+    //Keep the last column free for the white and transparent pixel.
+    skyline = {{0, 0, texture_size.x - 1}};
+    used_area = 0;
+    waste_area = 0;
+    image_count = 0;
+    add_list.clear();
+
+    //Throw away the old texture, so margins around new images are not filled with old image data.
+    if (gl_handle)
+    {
+        glDeleteTextures(1, &gl_handle);
+        gl_handle = 0;
+    }
+}
+
+glm::vec2 AtlasTexture::getWhitePixel() const
+{
+    return {(float(texture_size.x) - 0.5f) / float(texture_size.x), (float(texture_size.y) - 0.5f) / float(texture_size.y)};
+}
+
+glm::vec2 AtlasTexture::getTransparentPixel() const
+{
+    return {(float(texture_size.x) - 0.5f) / float(texture_size.x), 0.5f / float(texture_size.y)};
 }
 
 float AtlasTexture::usageRate()
 {
-    int all_texture_volume = texture_size.x * texture_size.y;
-    int unused_texture_volume = 0;
-    for(auto& area : available_areas)
-        unused_texture_volume += area.size.x * area.size.y;
-    return float(all_texture_volume - unused_texture_volume) / float(all_texture_volume);
+    return float(used_area) / float(texture_size.x * texture_size.y);
+}
+
+float AtlasTexture::wasteRate()
+{
+    return float(waste_area) / float(texture_size.x * texture_size.y);
 }
 
-void AtlasTexture::addArea(RectInt area)
+bool AtlasTexture::findPosition(glm::ivec2 size, glm::ivec2& position, size_t& node_index)
 {
-    //Ignore really slim areas, they are never really used and use up a lot of room in the available_areas otherwise.
-    if (area.size.x < 4 || area.size.y < 4)
-        return;
-    int area_volume = area.size.x * area.size.y;
-    auto it = std::lower_bound(available_areas.begin(), available_areas.end(), area_volume, [](const RectInt& r, int volume) -> bool
+    int best_bottom = std::numeric_limits<int>::max();
+    int best_width = std::numeric_limits<int>::max();
+    for(size_t n=0; n<skyline.size(); n++)
     {
-        return r.size.x * r.size.y > volume;
-    });
-    available_areas.insert(it, area);
+        int x = skyline[n].x;
+        if (x + size.x > texture_size.x - 1)
+            break;
+        //The area rests on the highest skyline node it overlaps.
+        int y = 0;
+        for(size_t m=n; m<skyline.size() && skyline[m].x < x + size.x; m++)
+            y = std::max(y, skyline[m].y);
+        if (y + size.y > texture_size.y)
+            continue;
+        if (y + size.y < best_bottom || (y + size.y == best_bottom && skyline[n].width < best_width))
+        {
+            best_bottom = y + size.y;
+            best_width = skyline[n].width;
+            position = {x, y};
+            node_index = n;
+        }
+    }
+    return best_bottom != std::numeric_limits<int>::max();
 }
 
 }//namespace sp
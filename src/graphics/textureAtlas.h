@@ -11,40 +11,67 @@ namespace sp {
     An AtlasTexture is a texture that contains multiple images layed out inside the same texture unit.
     The advantage of this is that there are less texture state changes during rendering, which is an inefficient
     action.
+    Images are packed with a skyline allocator, images cannot be removed individually, but the whole atlas can be cleared
+    and refilled with the images that are still in use.
+    The last column of pixels is never used for images, it contains a transparent pixel in the top right corner,
+    and a white pixel in the bottom right corner.
  */
 class AtlasTexture : public Texture
 {
 public:
     AtlasTexture(glm::ivec2 size);
     virtual ~AtlasTexture();
-    
+
     virtual void bind() override;
 
     //Only check if we can add this image, while this does the same work as add(), it does not claim ownership of the image
     //And thus the image can be placed somewhere else if this check fails.
     bool canAdd(const Image& image, int margin=0);
-    
+
     //Add an image to the atlas and return the area where the image is located in normalized coordinates.
     //Returns a negative size if the image cannot be added.
     Rect add(Image&& image, int margin=0);
-    
+
+    //Read back the whole texture, including images that are not uploaded yet, so images can be moved to a cleared atlas
+    //without decoding them again. Returns false when the GL context cannot read textures back.
+    bool download(Image& image);
+
+    //Remove all images from the atlas, and optionally give it a new size.
+    //All areas returned by add() before this call are invalid afterwards.
+    void clear();
+    void clear(glm::ivec2 new_size);
+
+    glm::ivec2 getSize() const { return texture_size; }
+    //Normalized coordinates of a white and a fully transparent pixel, which are always available.
+    glm::vec2 getWhitePixel() const;
+    glm::vec2 getTransparentPixel() const;
+
     //Return between 0.0 and 1.0 to indicate how much area of this texture is already used.
     // Where 0.0 is fully empty and 1.0 is fully used (never really happens due to overhead)
     float usageRate();
+    //Return between 0.0 and 1.0 to indicate how much area is lost below the skyline and can no longer be used until the atlas is cleared.
+    float wasteRate();
+    //Amount of images added since the last clear.
+    int getImageCount() const { return image_count; }
 private:
-    struct RectInt
+    struct SkylineNode
     {
-        glm::ivec2 position;
-        glm::ivec2 size;
+        int x;
+        int y;
+        int width;
     };
-    void addArea(RectInt area);
+    //Find the lowest position where an area of the given size fits, returns false if there is no room left.
+    bool findPosition(glm::ivec2 size, glm::ivec2& position, size_t& node_index);
 
     bool smooth;
     unsigned int gl_handle;
 
     glm::ivec2 texture_size;
-    std::vector<RectInt> available_areas;
-    
+    std::vector<SkylineNode> skyline;
+    int used_area = 0;
+    int waste_area = 0;
+    int image_count = 0;
+
     class ToAdd
     {
     public:
@@ -226,6 +226,12 @@ public:
         return buffer.size() - read_index;
     }
 
+    // Skip data that was read without going through this buffer.
+    void skip(size_t size)
+    {
+        read_index = std::min(buffer.size(), read_index + size);
+    }
+
     DataBuffer& operator <<(bool data) { write(data); return *this; }
     DataBuffer& operator <<(int8_t data) { write(data); return *this; }
     DataBuffer& operator <<(uint8_t data) { write(data); return *this; }
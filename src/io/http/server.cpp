@@ -4,6 +4,16 @@
 #include <logging.h>
 
 #include <string.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 /**< Map to convert between character encodings */
 static const signed char HEX2DEC[256] =
@@ -101,6 +111,88 @@ namespace websocket {
     static constexpr int opcode_pong = 0x0a;
 };
 
+//Requests with more headers than this are refused, so a client cannot make us buffer without end.
+static constexpr size_t max_header_size = 64 * 1024;
+static constexpr size_t max_post_size = 16 * 1024 * 1024;
+static constexpr size_t receive_size = 4096;
+//Static files up to this size are kept in memory, till the whole cache grows over the cache limit.
+static constexpr size_t max_cached_file_size = 256 * 1024;
+static constexpr size_t static_file_cache_limit = 32 * 1024 * 1024;
+//Websockets that fall this far behind on sending are closed, instead of queueing frames for them without end.
+static constexpr size_t max_websocket_send_queue_size = 4 * 1024 * 1024;
+
+static const char* statusText(int reply_code)
+{
+    switch(reply_code)
+    {
+    case 200: return "OK";
+    case 304: return "Not Modified";
+    case 404: return "Not Found";
+    }
+    return "OK";
+}
+
+static const char* mimeType(const string& path)
+{
+    static const std::pair<const char*, const char*> types[] = {
+        {".html", "text/html"},
+        {".htm", "text/html"},
+        {".js", "text/javascript"},
+        {".mjs", "text/javascript"},
+        {".css", "text/css"},
+        {".json", "application/json"},
+        {".txt", "text/plain"},
+        {".svg", "image/svg+xml"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".jpeg", "image/jpeg"},
+        {".gif", "image/gif"},
+        {".ico", "image/x-icon"},
+        {".wasm", "application/wasm"},
+        {".woff", "font/woff"},
+        {".woff2", "font/woff2"},
+    };
+    for(auto& type : types)
+        if (path.endswith(type.first))
+            return type.second;
+    return "";
+}
+
+//Build a complete, unmasked websocket frame, so it can be sent as is to any number of connections.
+static std::shared_ptr<const std::string> buildWebsocketFrame(int opcode, const void* data, size_t size)
+{
+    auto frame = std::make_shared<std::string>();
+    frame->reserve(size + 10);
+    frame->push_back(char(websocket::fin_mask | opcode));
+    if (size < websocket::payload_length_16bit)
+    {
+        frame->push_back(char(size));
+    }
+    else if (size < (1 << 16))
+    {
+        frame->push_back(char(websocket::payload_length_16bit));
+        frame->push_back(char((size >> 8) & 0xFF));
+        frame->push_back(char(size & 0xFF));
+    }
+    else
+    {
+        frame->push_back(char(websocket::payload_length_64bit));
+        for(int shift=56; shift>=0; shift-=8)
+            frame->push_back(char((uint64_t(size) >> shift) & 0xFF));
+    }
+    frame->append(static_cast<const char*>(data), size);
+    return frame;
+}
+
+static int openFile(const string& path)
+{
+#ifdef _WIN32
+    return _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    return ::open(path.c_str(), O_RDONLY);
+#endif
+}
+
 Server::Server(int port_nr)
 {
     if (!listen_socket.listen(port_nr))
@@ -109,6 +201,7 @@ Server::Server(int port_nr)
         return;
     }
 
+    listen_socket.setBlocking(false);
     handler_thread = std::thread([this]() { handlerThread(); });
 }
 
@@ -125,6 +218,8 @@ void Server::setStaticFilePath(const string& static_file_path)
 {
     std::lock_guard<std::recursive_mutex> lock(mutex);
     
+    static_file_cache.clear();
+    static_file_cache_size = 0;
     this->static_file_path = static_file_path;
     if (!this->static_file_path.endswith("/"))
         this->static_file_path += "/";
@@ -152,6 +247,16 @@ void Server::addAdvancedWebsocketHandler(const string& url, std::function<P<Webs
 }
 
 void Server::broadcastToWebsockets(const string& url, const string& data)
+{
+    broadcastWebsocketFrame(url, buildWebsocketFrame(websocket::opcode_text, data.data(), data.size()));
+}
+
+void Server::broadcastToWebsockets(const string& url, const io::DataBuffer& data)
+{
+    broadcastWebsocketFrame(url, buildWebsocketFrame(websocket::opcode_binary, data.getData(), data.getDataSize()));
+}
+
+void Server::broadcastWebsocketFrame(const string& url, const std::shared_ptr<const std::string>& frame)
 {
     std::lock_guard<std::recursive_mutex> lock(mutex);
     
@@ -160,7 +265,7 @@ void Server::broadcastToWebsockets(const string& url, const string& data)
         if (connection.remove)
             continue;
         if (connection.state == Connection::State::Websocket && connection.request.path == url)
-            connection.sendWebsocketTextPacket(data);
+            connection.sendWebsocketFrame(frame);
     }
 }
 
@@ -170,15 +275,23 @@ void Server::handlerThread()
     selector.add(listen_socket);
     while(listen_socket.isListening())
     {
-        selector.wait(1000);
+        //Replies from the main thread that did not fit in the socket are only noticed here, so do not sleep too long.
+        selector.wait(100);
 
         std::lock_guard<std::recursive_mutex> lock(mutex);
-        if (selector.isReady(listen_socket))
+        //Accept all waiting connections, so a crowd of websockets connecting at once does not overflow the backlog.
+        while(selector.isReady(listen_socket))
         {
             connections.emplace_back(*this);
             Connection& connection = connections.back();
-            listen_socket.accept(connection.socket);
-            connection.last_received_data_time = std::chrono::steady_clock::now();
+            //Sockets never block, so the mutex is only held for as long as it takes to hand data to the OS.
+            connection.socket.setBlocking(false);
+            if (!listen_socket.accept(connection.socket))
+            {
+                connections.pop_back();
+                break;
+            }
+            connection.last_activity_time = std::chrono::steady_clock::now();
             selector.add(connection.socket);
         }
         for(auto it = connections.begin(); it != connections.end();)
@@ -191,17 +304,21 @@ void Server::handlerThread()
             }
             if (selector.isReady(connection.socket))
             {
-                connection.last_received_data_time = std::chrono::steady_clock::now();
+                connection.last_activity_time = std::chrono::steady_clock::now();
                 connection.remove = !connection.processIncommingData();
             }
             else
             {
-                if (std::chrono::steady_clock::now() - connection.last_received_data_time > std::chrono::seconds(5))
+                if (std::chrono::steady_clock::now() - connection.last_activity_time > std::chrono::seconds(5))
                     connection.remove = !connection.handleTimeout();
             }
+            if (!connection.remove)
+                connection.remove = !connection.continueProcessing();
             
             if (connection.remove)
                 selector.remove(connection.socket);
+            else
+                selector.watchWrite(connection.socket, connection.hasPendingOutput());
             it++;
         }
     }
@@ -263,155 +380,223 @@ void Server::update(float delta)
 Server::Connection::Connection(Server& server)
 : server(server)
 {
-    buffer.reserve(4096);
+    buffer.reserve(receive_size);
     state = State::HTTPRequest;
     remove = false;
 }
 
+Server::Connection::~Connection()
+{
+    closeFile();
+}
+
 bool Server::Connection::processIncommingData()
 {
-    char receive_buffer[4096];
-    size_t received_size;
-    received_size = socket.receive(receive_buffer, sizeof(receive_buffer));
+    if (buffer_start > 0 && buffer_start >= buffer.size() / 2)
+    {
+        buffer.erase(buffer.begin(), buffer.begin() + buffer_start);
+        buffer_start = 0;
+    }
+    size_t used = buffer.size();
+    buffer.resize(used + receive_size);
+    size_t received_size = socket.receive(buffer.data() + used, receive_size);
+    buffer.resize(used + received_size);
     if (received_size < 1)
         return false;
-    buffer.resize(buffer.size() + received_size);
-    memcpy(&buffer[buffer.size()] - received_size, receive_buffer, received_size);
-    
-    switch(state)
+    return processBuffer();
+}
+
+void Server::Connection::consume(size_t size)
+{
+    buffer_start += size;
+    header_search_offset = 0;
+    if (buffer_start == buffer.size())
     {
-    case State::HTTPRequest:{
-        int headers_end = buffer.find("\r\n\r\n");
-        if (headers_end)
+        buffer.clear();
+        buffer_start = 0;
+    }
+}
+
+//Handle all complete requests in the buffer. A pipelined request waits till the reply to the previous one is done,
+//  as replies have to be sent in order.
+bool Server::Connection::processBuffer()
+{
+    while(buffer_start < buffer.size())
+    {
+        if (state == State::Websocket)
+            return processWebsocketFrames();
+        if (request_pending || file != -1 || !keep_alive)
+            return true;
+
+        std::string_view data(buffer.data() + buffer_start, buffer.size() - buffer_start);
+        //Only search the newly received data, including the last 3 bytes, the end marker can be split over two receives.
+        auto headers_end = data.find("\r\n\r\n", header_search_offset > 3 ? header_search_offset - 3 : 0);
+        if (headers_end == std::string_view::npos)
         {
-            std::vector<string> header_data = buffer.substr(0, headers_end).split("\r\n");
-            
-            std::vector<string> parts = header_data[0].split();
-            if (parts.size() != 3)
-                return false;
-            auto path_query = parts[1].partition("?");
-            request.method = parts[0];
-            request.path = path_query.first;
-            request.query.clear();
-            for(auto& param : path_query.second.split("&"))
-            {
-                auto key_value = param.partition("=");
-                if (!key_value.first.empty())
-                    request.query[uriDecode(key_value.first)] = uriDecode(key_value.second);
-            }
-            request.post_data = "";
-            request.headers.clear();
-            for(unsigned int n=1; n<header_data.size(); n++)
-            {
-                auto header_entry = header_data[n].partition(":");
-                request.headers[header_entry.first.strip().lower()] = header_entry.second.strip();
-            }
-            int post_length = 0;
-            if (request.headers.find("content-length") != request.headers.end())
-            {
-                post_length = request.headers["content-length"].toInt();
-                if (int(buffer.size()) < headers_end + 4 + post_length)
-                    break; //Not enough data yet, continue receiving.
-                request.post_data = buffer.substr(headers_end + 4, headers_end + 4 + post_length);
-            }
-            
-            buffer = buffer.substr(headers_end + 4 + post_length);
-            handleRequest(request);
+            header_search_offset = data.size();
+            return data.size() <= max_header_size;
         }
-        }break;
-    case State::Websocket:
-        while(true)
+        header_search_offset = headers_end;
+
+        std::vector<string> header_data = string(data.substr(0, headers_end)).split("\r\n");
+        std::vector<string> parts = header_data[0].split();
+        if (parts.size() != 3)
+            return false;
+        size_t post_length = 0;
+        auto content_length = std::find_if(header_data.begin() + 1, header_data.end(), [](const string& line) { return line.partition(":").first.strip().lower() == "content-length"; });
+        if (content_length != header_data.end())
         {
-            if (buffer.size() < 2)
-                return true;
-            unsigned int payload_length = buffer[1] & websocket::payload_length_mask;
-            int opcode = buffer[0] & websocket::opcode_mask;
-            bool fin = buffer[0] & websocket::fin_mask;
-            bool mask = buffer[1] & websocket::mask_mask;
-            unsigned int index = 2;
-
-            //Close the connection if any of the RSV bits are set.
-            if (buffer[0] & websocket::rsv_mask)
-            {
-                LOG(Warning, "Closing websocket due to RSV bits, we do not support extensions.");
+            post_length = std::max(0, content_length->partition(":").second.strip().toInt());
+            if (post_length > max_post_size)
                 return false;
-            }
+            if (data.size() < headers_end + 4 + post_length)
+                return true; //Not enough data yet, continue receiving.
+        }
 
-            if (payload_length == websocket::payload_length_16bit)
-            {
-                if (buffer.size() < index + 2)
-                    return true;
-                payload_length = uint8_t(buffer[index++]) << 8;
-                payload_length |= uint8_t(buffer[index++]);
-            }else if (payload_length == websocket::payload_length_64bit)
-            {
-                if (buffer.size() < index + 8)
-                    return true;
-                index += 4;
-                payload_length = uint8_t(buffer[index++]) << 24;
-                payload_length |= uint8_t(buffer[index++]) << 16;
-                payload_length |= uint8_t(buffer[index++]) << 8;
-                payload_length |= uint8_t(buffer[index++]);
-            }
+        auto path_query = parts[1].partition("?");
+        request.method = parts[0];
+        request.path = path_query.first;
+        request.query.clear();
+        for(auto& param : path_query.second.split("&"))
+        {
+            auto key_value = param.partition("=");
+            if (!key_value.first.empty())
+                request.query[uriDecode(key_value.first)] = uriDecode(key_value.second);
+        }
+        request.post_data = string(data.substr(headers_end + 4, post_length));
+        request.headers.clear();
+        for(unsigned int n=1; n<header_data.size(); n++)
+        {
+            auto header_entry = header_data[n].partition(":");
+            request.headers[header_entry.first.strip().lower()] = header_entry.second.strip();
+        }
+        auto connection_header = request.headers.find("connection");
+        if (parts[2] == "HTTP/1.0")
+            keep_alive = connection_header != request.headers.end() && connection_header->second.lower() == "keep-alive";
+        else
+            keep_alive = connection_header == request.headers.end() || connection_header->second.lower() != "close";
 
-            uint8_t mask_values[4] = {0, 0, 0, 0};
-            if (mask)
-            {
-                if (buffer.size() < index + 4)
-                    return true;
-                for(unsigned int n=0; n<4; n++)
-                    mask_values[n] = buffer[index++];
-                if (buffer.size() < index + payload_length)
-                    return true;
-                for(unsigned int n=0; n<payload_length; n++)
-                    buffer[index + n] ^= mask_values[n % 4];
-            }
-            if (buffer.size() < index + payload_length)
+        consume(headers_end + 4 + post_length);
+        handleRequest(request);
+    }
+    return true;
+}
+
+bool Server::Connection::processWebsocketFrames()
+{
+    while(true)
+    {
+        char* data = buffer.data() + buffer_start;
+        size_t size = buffer.size() - buffer_start;
+        if (size < 2)
+            return true;
+        unsigned int payload_length = data[1] & websocket::payload_length_mask;
+        int opcode = data[0] & websocket::opcode_mask;
+        bool fin = data[0] & websocket::fin_mask;
+        bool mask = data[1] & websocket::mask_mask;
+        unsigned int index = 2;
+
+        //Close the connection if any of the RSV bits are set.
+        if (data[0] & websocket::rsv_mask)
+        {
+            LOG(Warning, "Closing websocket due to RSV bits, we do not support extensions.");
+            return false;
+        }
+
+        if (payload_length == websocket::payload_length_16bit)
+        {
+            if (size < index + 2)
                 return true;
-            
-            string message = buffer.substr(index, index + payload_length);
-            buffer = buffer.substr(index + payload_length);
+            payload_length = uint8_t(data[index++]) << 8;
+            payload_length |= uint8_t(data[index++]);
+        }else if (payload_length == websocket::payload_length_64bit)
+        {
+            if (size < index + 8)
+                return true;
+            index += 4;
+            payload_length = uint8_t(data[index++]) << 24;
+            payload_length |= uint8_t(data[index++]) << 16;
+            payload_length |= uint8_t(data[index++]) << 8;
+            payload_length |= uint8_t(data[index++]);
+        }
 
-            switch(opcode)
+        uint8_t mask_values[4] = {0, 0, 0, 0};
+        if (mask)
+        {
+            if (size < index + 4)
+                return true;
+            for(unsigned int n=0; n<4; n++)
+                mask_values[n] = data[index++];
+        }
+        if (size < index + payload_length)
+            return true;
+        if (mask)
+        {
+            for(unsigned int n=0; n<payload_length; n++)
+                data[index + n] ^= mask_values[n % 4];
+        }
+        
+        string message(data + index, payload_length);
+        consume(index + payload_length);
+
+        switch(opcode)
+        {
+        case websocket::opcode_continuation:
+            websocket_received_fragment += message;
+            if (fin)
             {
-            case websocket::opcode_continuation:
-                websocket_received_fragment += message;
-                if (fin)
-                {
-                    websocket_received_pending.push_back(std::move(websocket_received_fragment));
-                    websocket_received_fragment = "";
-                }
-                break;
-            case websocket::opcode_text:
-            case websocket::opcode_binary:
-                if (fin)
-                    websocket_received_pending.push_back(message);
-                else
-                    websocket_received_fragment = message;
-                break;
-            case websocket::opcode_close:
-                {
-                    uint8_t reply[] = {websocket::fin_mask | websocket::opcode_close, 0};//close packet
-                    socket.send(reply, sizeof(reply));
-                }
-                return false;
-            case websocket::opcode_ping:
-                {
-                    //Note: The standard says that we need to include the payload of the ping packet as payload in the pong packet.
-                    //      We ignore this, as this no client seems to use this.
-                    uint8_t reply[] = {websocket::fin_mask | websocket::opcode_pong, 0};//pong packet
-                    socket.send(reply, sizeof(reply));
-                }
-                break;
-            case websocket::opcode_pong:
-                //There is no real need to track PONG replies. TCP/IP will close the connection if the other side is gone.
-                break;
+                websocket_received_pending.push_back(std::move(websocket_received_fragment));
+                websocket_received_fragment = "";
             }
+            break;
+        case websocket::opcode_text:
+        case websocket::opcode_binary:
+            if (fin)
+                websocket_received_pending.push_back(message);
+            else
+                websocket_received_fragment = message;
+            break;
+        case websocket::opcode_close:
+            sendWebsocketFrame(buildWebsocketFrame(websocket::opcode_close, nullptr, 0));
+            sendWebsocketQueue();
+            return false;
+        case websocket::opcode_ping:
+            //Note: The standard says that we need to include the payload of the ping packet as payload in the pong packet.
+            //      We ignore this, as this no client seems to use this.
+            sendWebsocketFrame(buildWebsocketFrame(websocket::opcode_pong, nullptr, 0));
+            break;
+        case websocket::opcode_pong:
+            //There is no real need to track PONG replies. TCP/IP will close the connection if the other side is gone.
+            break;
         }
-        break;
     }
-    
-    return true;
+}
+
+//Called on every pass of the handler thread: sends what is left of the current reply,
+//  and continues with pipelined requests once it is done.
+bool Server::Connection::continueProcessing()
+{
+    if (socket.getState() != sp::io::network::StreamSocket::State::Connected || websocket_send_overflow)
+        return false;
+    if (socket.sendSendQueue() || sendWebsocketQueue())
+        return true;
+    if (file != -1)
+    {
+        if (!sendFileData())
+            return false;
+        if (file != -1)
+            return true;
+    }
+    if (request_pending)
+        return true;
+    if (!keep_alive)
+        return false;
+    return processBuffer();
+}
+
+bool Server::Connection::hasPendingOutput()
+{
+    return file != -1 || socket.sendSendQueue() || !websocket_send_queue.empty();
 }
 
 bool Server::Connection::handleTimeout()
@@ -422,8 +607,7 @@ bool Server::Connection::handleTimeout()
         return false;
         }break;
     case State::Websocket:{
-        uint8_t ping[] = {websocket::fin_mask | websocket::opcode_ping, 0};
-        socket.send(ping, sizeof(ping));
+        sendWebsocketFrame(buildWebsocketFrame(websocket::opcode_ping, nullptr, 0));
         }break;
     }
     return true;
@@ -488,44 +672,143 @@ void Server::Connection::handleRequest(const Request& request)
         if (request.path.endswith("/"))
             full_path = full_path + "index.html";
     }
-    
-    FILE* f = fopen(full_path.c_str(), "rb");
-    if (f)
-    {
-        if (request.path.endswith(".js"))
-            startHttpReply(200, "text/javascript");
-        else if (request.path.endswith(".css"))
-            startHttpReply(200, "text/css");
-        else
-            startHttpReply(200);
-        while(true)
-        {
-            char buffer[1024];
-            size_t n = fread(buffer, 1, sizeof(buffer), f);
-            if (n < 1)
-                break;
+    sendStaticFile(request, full_path);
+}
 
-            string chunk_len_string = string::hex(static_cast<int>(n)) + "\r\n";
-            socket.send(chunk_len_string.c_str(), chunk_len_string.size());
-            socket.send(buffer, n);
-            socket.send("\r\n", 2);
-        }
-        fclose(f);
+void Server::Connection::sendStaticFile(const Request& request, const string& full_path)
+{
+    string path = full_path;
+    bool gzip = false;
+    std::error_code ec;
+    auto accept_encoding = request.headers.find("accept-encoding");
+    if (!full_path.empty() && accept_encoding != request.headers.end() && accept_encoding->second.find("gzip") != -1
+        && std::filesystem::is_regular_file(std::filesystem::u8path((full_path + ".gz").c_str()), ec))
+    {
+        path = full_path + ".gz";
+        gzip = true;
     }
-    else
+    auto fs_path = std::filesystem::u8path(path.c_str());
+    uint64_t size = full_path.empty() || !std::filesystem::is_regular_file(fs_path, ec) ? 0 : std::filesystem::file_size(fs_path, ec);
+    auto modified = std::filesystem::last_write_time(fs_path, ec);
+    if (full_path.empty() || ec)
     {
         startHttpReply(404);
         httpChunk("404 - File not found.");
+        httpChunk("");
 
         LOG(Warning, "File not found:", request.path);
+        return;
     }
-    httpChunk("");
+
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"%llx-%llx%s\"", static_cast<unsigned long long>(size), static_cast<unsigned long long>(modified.time_since_epoch().count()), gzip ? "-gz" : "");
+    auto if_none_match = request.headers.find("if-none-match");
+    bool not_modified = if_none_match != request.headers.end() && if_none_match->second == etag;
+
+    string reply = string("HTTP/1.1 ") + string(not_modified ? 304 : 200) + " " + statusText(not_modified ? 304 : 200) + "\r\n";
+    reply += keep_alive ? "Connection: Keep-Alive\r\n" : "Connection: close\r\n";
+    auto mimetype = mimeType(full_path);
+    if (mimetype[0])
+        reply += string("Content-Type: ") + mimetype + "\r\n";
+    if (gzip)
+        reply += "Content-Encoding: gzip\r\n";
+    reply += "Vary: Accept-Encoding\r\n";
+    reply += string("ETag: ") + etag + "\r\n";
+    //Let the browser keep the file, but check with us before using it, so changed files show up right away.
+    reply += "Cache-Control: no-cache\r\n";
+    if (!not_modified)
+        reply += "Content-Length: " + std::to_string(size) + "\r\n";
+    reply += "\r\n";
+    if (not_modified || request.method == "HEAD")
+    {
+        socket.send(reply.data(), reply.size());
+        return;
+    }
+
+    auto it = server.static_file_cache.find(path);
+    if (it != server.static_file_cache.end() && it->second.etag == etag)
+    {
+        reply += it->second.data;
+        socket.send(reply.data(), reply.size());
+        return;
+    }
+    if (size <= max_cached_file_size)
+    {
+        std::ifstream input(fs_path, std::ios::binary);
+        std::string data(size, '\0');
+        if (input.read(data.data(), data.size()))
+        {
+            if (it != server.static_file_cache.end())
+                server.static_file_cache_size -= it->second.data.size();
+            if (server.static_file_cache_size + data.size() > static_file_cache_limit)
+            {
+                server.static_file_cache.clear();
+                server.static_file_cache_size = 0;
+            }
+            server.static_file_cache_size += data.size();
+            reply += data;
+            server.static_file_cache[path] = {etag, std::move(data)};
+            socket.send(reply.data(), reply.size());
+            return;
+        }
+    }
+
+    file = openFile(path);
+    if (file == -1)
+    {
+        //We already promised the size in the header, so the connection has to go.
+        LOG(Warning, "Failed to open:", path);
+        socket.send(reply.data(), reply.size());
+        keep_alive = false;
+        return;
+    }
+    file_offset = 0;
+    file_remaining = size;
+    socket.send(reply.data(), reply.size());
+    if (!sendFileData())
+        closeFile();
+}
+
+//Send as much of the file as the socket takes without blocking, the rest is sent when the socket can take more.
+bool Server::Connection::sendFileData()
+{
+    while(file_remaining > 0)
+    {
+        size_t sent;
+        if (!socket.sendFile(file, file_offset, static_cast<size_t>(std::min<uint64_t>(file_remaining, 1024 * 1024)), sent))
+        {
+            //The file changed while it was served, the promised size cannot be sent anymore.
+            LOG(Warning, "File became shorter while it was sent");
+            closeFile();
+            keep_alive = false;
+            return false;
+        }
+        if (sent == 0)
+            return socket.getState() == sp::io::network::StreamSocket::State::Connected;
+        file_offset += sent;
+        file_remaining -= sent;
+        last_activity_time = std::chrono::steady_clock::now();
+    }
+    closeFile();
+    return true;
+}
+
+void Server::Connection::closeFile()
+{
+    if (file == -1)
+        return;
+#ifdef _WIN32
+    _close(file);
+#else
+    ::close(file);
+#endif
+    file = -1;
 }
 
 void Server::Connection::startHttpReply(int reply_code, const string& mimetype)
 {
-    string reply = string("HTTP/1.1 ") + string(reply_code) + " OK\r\n";
-    reply += "Connection: Keep-Alive\r\n";
+    string reply = string("HTTP/1.1 ") + string(reply_code) + " " + statusText(reply_code) + "\r\n";
+    reply += keep_alive ? "Connection: Keep-Alive\r\n" : "Connection: close\r\n";
     if (mimetype.length() > 0)
         reply += "Content-Type: " + mimetype + "\r\n";
     reply += "Transfer-Encoding: chunked\r\n";
@@ -542,47 +825,64 @@ void Server::Connection::httpChunk(const string& data)
     socket.send("\r\n", 2);
 }
 
-void Server::Connection::sendWebsocketTextPacket(const string& data)
+//Frames are sent right away when nothing is waiting, what the socket does not take is kept by reference, not copied.
+void Server::Connection::sendWebsocketFrame(std::shared_ptr<const std::string> frame)
 {
-    if (data.size() < websocket::payload_length_16bit)
+    if (websocket_send_overflow)
+        return;
+    if (websocket_send_queue.empty())
     {
-        uint8_t header[] = {
-            websocket::fin_mask | websocket::opcode_text,
-            uint8_t(data.size()),
-        };
-        socket.send(header, sizeof(header));
+        size_t sent = socket.sendPartial(frame->data(), frame->size());
+        if (sent == frame->size())
+            return;
+        websocket_send_offset = sent;
     }
-    else if (data.size() < (1 << 16))
+    else if (websocket_send_queue_size + frame->size() > max_websocket_send_queue_size)
     {
-        uint8_t header[] = {
-            websocket::fin_mask | websocket::opcode_text,
-            websocket::payload_length_16bit,
-            uint8_t((data.size() >> 8) & 0xFF),
-            uint8_t(data.size() & 0xFF),
-        };
-        socket.send(header, sizeof(header));
+        //The handler thread closes the connection on its next pass.
+        LOG(Warning, "Closing websocket that does not keep up with sending: ", request.path);
+        websocket_send_overflow = true;
+        websocket_send_queue.clear();
+        websocket_send_queue_size = 0;
+        return;
     }
-    else
+    websocket_send_queue_size += frame->size();
+    websocket_send_queue.push_back(std::move(frame));
+}
+
+//Returns true if there are still frames waiting after sending.
+bool Server::Connection::sendWebsocketQueue()
+{
+    while(!websocket_send_queue.empty())
     {
-        uint8_t header[] = {
-            websocket::fin_mask | websocket::opcode_text,
-            websocket::payload_length_64bit,
-            0, 0, 0, 0,
-            uint8_t((data.size() >> 24) & 0xFF),
-            uint8_t((data.size() >> 16) & 0xFF),
-            uint8_t((data.size() >> 8) & 0xFF),
-            uint8_t(data.size() & 0xFF),
-        };
-        socket.send(header, sizeof(header));
+        auto& frame = *websocket_send_queue.front();
+        websocket_send_offset += socket.sendPartial(frame.data() + websocket_send_offset, frame.size() - websocket_send_offset);
+        if (websocket_send_offset < frame.size())
+            return true;
+        websocket_send_queue_size -= frame.size();
+        websocket_send_queue.pop_front();
+        websocket_send_offset = 0;
     }
-    
-    socket.send(data.data(), data.size());
+    return false;
 }
 
+//The connection pointer is only changed from Server::update, but the send queue is also drained by the handler thread.
 void WebsocketHandler::send(const string& message)
 {
-    if (connection)
-        connection->sendWebsocketTextPacket(message);
+    if (!connection)
+        return;
+    auto frame = buildWebsocketFrame(websocket::opcode_text, message.data(), message.size());
+    std::lock_guard<std::recursive_mutex> lock(connection->server.mutex);
+    connection->sendWebsocketFrame(std::move(frame));
+}
+
+void WebsocketHandler::send(const io::DataBuffer& data)
+{
+    if (!connection)
+        return;
+    auto frame = buildWebsocketFrame(websocket::opcode_binary, data.getData(), data.getDataSize());
+    std::lock_guard<std::recursive_mutex> lock(connection->server.mutex);
+    connection->sendWebsocketFrame(std::move(frame));
 }
 
 }//namespace http
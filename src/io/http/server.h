@@ -5,7 +5,9 @@
 #include <Updatable.h>
 #include <io/network/tcpListener.h>
 #include <io/network/tcpSocket.h>
+#include <deque>
 #include <list>
+#include <memory>
 #include <thread>
 #include <mutex>
 #include <chrono>
@@ -25,6 +27,9 @@ class WebsocketHandler;
         * APIs
         * Websockets
     Protocol and file handling is done on a separate thread, while URL handlers and Websocket handlers are processed on the main thread.
+    Connections are kept alive and can pipeline requests. Static files are sent with sendfile() where available,
+    small files are kept in memory, and validated with ETags so browsers get a 304 for files they already have.
+    When the browser accepts gzip and a precompressed "file.gz" exists next to "file", that is sent instead.
  */
 class Server : public Updatable
 {
@@ -44,6 +49,7 @@ public:
     
     //Set the path on the filesystem where statics files are read from.
     //  Note: This does not use the ResourceProvider system.
+    //  Files are assumed to change rarely, but a changed size or modification time is noticed on the next request.
     void setStaticFilePath(const string& static_file_path);
     //Add a callback function to handle a specific URL request.
     // The URL should be prefixed with a "/", the return value of the callback is send back as data to the browser.
@@ -58,8 +64,13 @@ public:
     void addAdvancedWebsocketHandler(const string& url, std::function<P<WebsocketHandler>()> func);
     //Send a message to all connected websockets to a specific URL endpoint.
     //  No distinction is made between websockets, all are equal. Useful to distribute game state to all websockets.
+    //  The websocket frame is built once, and shared by all connections till each of them has sent it.
+    //  Connections that fall too far behind on sending are closed.
     void broadcastToWebsockets(const string& url, const string& data);
+    //Same as above, but sends the data as a binary message.
+    void broadcastToWebsockets(const string& url, const io::DataBuffer& data);
 private:
+    void broadcastWebsocketFrame(const string& url, const std::shared_ptr<const std::string>& frame);
     string static_file_path;
 
     void handlerThread();
@@ -71,33 +82,68 @@ private:
     std::map<string, std::function<void(const string& data)>> simple_websocket_handlers;
     std::map<string, std::function<P<WebsocketHandler>()>> advanced_websocket_handlers;
 
+    //Small static files with their reply headers, only used from the handler thread.
+    struct CachedFile
+    {
+        string etag;
+        std::string data;
+    };
+    std::unordered_map<string, CachedFile> static_file_cache;
+    size_t static_file_cache_size = 0;
+
     sp::io::network::TcpListener listen_socket;
     
     class Connection : sp::NonCopyable
     {
     public:
         Connection(Server& server);
+        ~Connection();
         
         bool remove;
 
         sp::io::network::TcpSocket socket;
-        std::chrono::steady_clock::time_point last_received_data_time;
-        string buffer;
+        std::chrono::steady_clock::time_point last_activity_time;
+        //Received data that is not parsed yet starts at buffer_start. Parsed requests only move the start,
+        //  the rest is moved to the front once the start passed half the buffer, so a request is never copied more than once.
+        std::vector<char> buffer;
+        size_t buffer_start = 0;
+        size_t header_search_offset = 0;
         Server& server;
         
         Request request;
         bool request_pending = false;
+        bool keep_alive = true;
         bool websocket_connected = false;
         string websocket_received_fragment;
         std::vector<string> websocket_received_pending;
         P<WebsocketHandler> websocket_handler;
+        //Websocket frames that the socket did not take yet, the first one is sent from websocket_send_offset.
+        std::deque<std::shared_ptr<const std::string>> websocket_send_queue;
+        size_t websocket_send_offset = 0;
+        size_t websocket_send_queue_size = 0;
+        //Set when the queue grew over its limit, the connection is closed instead of sending more.
+        bool websocket_send_overflow = false;
+
+        //Static file that is still being sent.
+        int file = -1;
+        uint64_t file_offset = 0;
+        uint64_t file_remaining = 0;
 
         bool processIncommingData();
+        bool processBuffer();
+        bool processWebsocketFrames();
+        bool continueProcessing();
+        bool hasPendingOutput();
         bool handleTimeout();
+        void consume(size_t size);
         void handleRequest(const Request& request);
+        void sendStaticFile(const Request& request, const string& full_path);
+        bool sendFileData();
+        void closeFile();
         void startHttpReply(int reply_code, const string& mimetype="");
         void httpChunk(const string& data);
-        void sendWebsocketTextPacket(const string& data);
+        void sendWebsocketFrame(std::shared_ptr<const std::string> frame);
+        bool sendWebsocketQueue();
         
         enum class State
         {
@@ -119,6 +165,7 @@ public:
     virtual void onDisconnect() = 0;
     
     void send(const string& message);
+    void send(const io::DataBuffer& data);
 private:
     Server::Connection* connection = nullptr;
     
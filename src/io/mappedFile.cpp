@@ -0,0 +1,115 @@
+#include "io/mappedFile.h"
+
+#include <SDL.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif !defined(ANDROID)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+namespace sp {
+namespace io {
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const string& filename)
+{
+    close();
+#if defined(_WIN32)
+    HANDLE file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE)
+        return false;
+    file = file_handle;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0)
+    {
+        close();
+        return false;
+    }
+    map = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!map)
+    {
+        close();
+        return false;
+    }
+    data_ptr = static_cast<const uint8_t*>(MapViewOfFile(static_cast<HANDLE>(map), FILE_MAP_READ, 0, 0, 0));
+    data_size = static_cast<size_t>(file_size.QuadPart);
+    if (!data_ptr)
+        close();
+#elif !defined(ANDROID)
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    void* ptr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED)
+        return false;
+    data_ptr = static_cast<const uint8_t*>(ptr);
+    data_size = static_cast<size_t>(st.st_size);
+    mapped = true;
+#else
+    //Android files can live in the assets bundle, which SDL can read but we cannot map.
+    SDL_RWops* io = SDL_RWFromFile(filename.c_str(), "rb");
+    if (!io)
+        return false;
+    auto file_size = SDL_RWsize(io);
+    if (file_size > 0)
+    {
+        buffer.reset(new uint8_t[file_size]);
+        if (SDL_RWread(io, buffer.get(), 1, file_size) == static_cast<size_t>(file_size))
+        {
+            data_ptr = buffer.get();
+            data_size = static_cast<size_t>(file_size);
+        }
+        else
+        {
+            buffer.reset();
+        }
+    }
+    SDL_RWclose(io);
+#endif
+    return data_ptr != nullptr;
+}
+
+void MappedFile::close()
+{
+#if defined(_WIN32)
+    if (data_ptr)
+        UnmapViewOfFile(data_ptr);
+    if (map)
+        CloseHandle(static_cast<HANDLE>(map));
+    if (file)
+        CloseHandle(static_cast<HANDLE>(file));
+    map = nullptr;
+    file = nullptr;
+#elif !defined(ANDROID)
+    if (mapped)
+        munmap(const_cast<uint8_t*>(data_ptr), data_size);
+    mapped = false;
+#else
+    buffer.reset();
+#endif
+    data_ptr = nullptr;
+    data_size = 0;
+}
+
+}//namespace io
+}//namespace sp
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <stringImproved.h>
+#include <nonCopyable.h>
+
+
+namespace sp {
+namespace io {
+
+/**
+    Read only view on the contents of a file. Memory mapped where possible, else the whole file is loaded in memory.
+    On Android the file is read through SDL, so files in the assets bundle can be used.
+ */
+class MappedFile : sp::NonCopyable
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    bool open(const string& filename);
+    void close();
+
+    bool isOpen() const { return data_ptr != nullptr; }
+    const uint8_t* data() const { return data_ptr; }
+    size_t size() const { return data_size; }
+private:
+    const uint8_t* data_ptr = nullptr;
+    size_t data_size = 0;
+
+#if defined(_WIN32)
+    void* file = nullptr;
+    void* map = nullptr;
+#elif !defined(ANDROID)
+    bool mapped = false;
+#else
+    std::unique_ptr<uint8_t[]> buffer;
+#endif
+};
+
+}//namespace io
+}//namespace sp
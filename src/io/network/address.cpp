@@ -2,6 +2,12 @@
 #include <io/network/socketBase.h>
 #include <logging.h>
 #include <cstring>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -27,13 +33,158 @@ Address::Address()
 {
 }
 
+namespace {
+//Names that resolved are kept this long, names that failed to resolve are retried sooner.
+static constexpr auto resolve_ttl = std::chrono::seconds(60);
+static constexpr auto resolve_failure_ttl = std::chrono::seconds(5);
+//A name that does not respond can keep a resolver thread busy for many seconds, a few threads keep the other names going.
+static constexpr size_t max_resolver_threads = 4;
+static constexpr size_t max_cache_size = 256;
+
+struct Resolver
+{
+    struct Entry
+    {
+        std::shared_future<Address> result;
+        //time_point::max() while the lookup is still running.
+        std::chrono::steady_clock::time_point expires;
+    };
+    struct Job
+    {
+        string hostname;
+        std::promise<Address> promise;
+    };
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::unordered_map<string, Entry> cache;
+    std::deque<Job> jobs;
+    size_t thread_count = 0;
+    size_t idle_count = 0;
+
+    //Find a result that is still valid, or a lookup that is still running. Call with the mutex locked.
+    const Entry* find(const string& hostname)
+    {
+        auto it = cache.find(hostname);
+        if (it == cache.end())
+            return nullptr;
+        if (it->second.expires <= std::chrono::steady_clock::now())
+        {
+            cache.erase(it);
+            return nullptr;
+        }
+        return &it->second;
+    }
+
+    //Call with the mutex locked.
+    void store(const string& hostname, std::shared_future<Address> result, std::chrono::steady_clock::time_point expires)
+    {
+        if (cache.size() >= max_cache_size)
+        {
+            auto now = std::chrono::steady_clock::now();
+            for(auto it = cache.begin(); it != cache.end(); )
+            {
+                if (it->second.expires <= now)
+                    it = cache.erase(it);
+                else
+                    ++it;
+            }
+        }
+        cache[hostname] = {std::move(result), expires};
+    }
+
+    //Never destroyed, the resolver threads are detached and can still be running a lookup while the program exits.
+    static Resolver& get()
+    {
+        static Resolver* instance = new Resolver();
+        return *instance;
+    }
+};
+}
+
 Address::Address(const string& hostname)
+{
+    auto& resolver = Resolver::get();
+    std::shared_future<Address> result;
+    {
+        std::lock_guard<std::mutex> lock(resolver.mutex);
+        if (auto entry = resolver.find(hostname))
+            result = entry->result;
+    }
+    if (result.valid())
+    {
+        //Waits if a resolver thread is still looking up this name, which is no slower than looking it up again.
+        addr_info = result.get().addr_info;
+        return;
+    }
+
+    addr_info = lookup(hostname).addr_info;
+
+    std::promise<Address> promise;
+    promise.set_value(*this);
+    std::lock_guard<std::mutex> lock(resolver.mutex);
+    resolver.store(hostname, promise.get_future().share(), std::chrono::steady_clock::now() + (addr_info.empty() ? resolve_failure_ttl : resolve_ttl));
+}
+
+std::shared_future<Address> Address::resolve(const string& hostname)
+{
+    auto& resolver = Resolver::get();
+    std::lock_guard<std::mutex> lock(resolver.mutex);
+    if (auto entry = resolver.find(hostname))
+        return entry->result;
+
+    Resolver::Job job{hostname, {}};
+    auto result = job.promise.get_future().share();
+    resolver.store(hostname, result, std::chrono::steady_clock::time_point::max());
+    resolver.jobs.emplace_back(std::move(job));
+
+    if (resolver.idle_count > 0 || resolver.thread_count >= max_resolver_threads)
+    {
+        resolver.wakeup.notify_one();
+        return result;
+    }
+    resolver.thread_count++;
+    std::thread([&resolver]()
+    {
+        std::unique_lock<std::mutex> lock(resolver.mutex);
+        while(true)
+        {
+            if (resolver.jobs.empty())
+            {
+                resolver.idle_count++;
+                resolver.wakeup.wait(lock, [&resolver]() { return !resolver.jobs.empty(); });
+                resolver.idle_count--;
+            }
+            auto job = std::move(resolver.jobs.front());
+            resolver.jobs.pop_front();
+
+            lock.unlock();
+            auto address = lookup(job.hostname);
+            lock.lock();
+
+            auto it = resolver.cache.find(job.hostname);
+            if (it != resolver.cache.end() && it->second.expires == std::chrono::steady_clock::time_point::max())
+                it->second.expires = std::chrono::steady_clock::now() + (address.addr_info.empty() ? resolve_failure_ttl : resolve_ttl);
+            job.promise.set_value(std::move(address));
+        }
+    }).detach();
+    return result;
+}
+
+Address Address::lookup(const string& hostname)
 {
     SocketBase::initSocketLib();
+    std::list<AddrInfo> addr_info;
 #ifndef EMSCRIPTEN
+    //Only ask for one socket type, else every address is returned for each type.
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
     struct addrinfo* result;
-    if (::getaddrinfo(hostname.c_str(), nullptr, nullptr, &result))
-        return;
+    if (::getaddrinfo(hostname.c_str(), nullptr, &hints, &result))
+        return Address();
 
     for(struct addrinfo* data=result; data != nullptr; data=data->ai_next)
     {
@@ -47,6 +198,7 @@ Address::Address(const string& hostname)
     }
     ::freeaddrinfo(result);
 #endif
+    return Address(std::move(addr_info));
 }
 
 Address::Address(std::list<AddrInfo>&& addr_info)
@@ -4,6 +4,7 @@
 #include <stringImproved.h>
 #include <cstdint>
 #include <list>
+#include <future>
 
 
 namespace sp {
@@ -17,6 +18,12 @@ public:
     Address();
     Address(const string& hostname);
 
+    //Resolve the hostname on one of the resolver threads, so the caller does not block on DNS.
+    //  Poll the future with wait_for(0) till it is ready, an Address without entries means the name did not resolve.
+    //  Results are cached for a while, resolving a name again within that time does not hit DNS. The blocking
+    //  constructor above shares this cache.
+    static std::shared_future<Address> resolve(const string& hostname);
+
     std::vector<string> getHumanReadable() const;
 
     bool operator==(const Address& other) const;
@@ -35,6 +42,8 @@ private:
     };
 
     Address(std::list<AddrInfo>&& addr_info);
+
+    static Address lookup(const string& hostname);
     
     std::list<AddrInfo> addr_info;
     
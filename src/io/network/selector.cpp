@@ -77,6 +77,15 @@ void Selector::remove(SocketBase& socket)
     }
 }
 
+void Selector::watchWrite(SocketBase& socket, bool watch)
+{
+    for(auto& pfd : data->fds)
+    {
+        if (pfd.fd == socket.handle)
+            pfd.events = watch ? (POLLIN | POLLOUT) : POLLIN;
+    }
+}
+
 void Selector::wait(int timeout_ms)
 {
 #ifdef _WIN32
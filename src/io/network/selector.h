@@ -19,6 +19,8 @@ public:
     
     void add(SocketBase& socket);
     void remove(SocketBase& socket);
+    //Also wake up wait() when the socket can take more data to send.
+    void watchWrite(SocketBase& socket, bool watch);
     void wait(int timeout_ms);
     bool isReady(SocketBase& socket);
 
@@ -39,6 +39,21 @@ void StreamSocket::queue(const void* data, size_t size)
     send_queue += std::string(static_cast<const char*>(data), size);
 }
 
+size_t StreamSocket::sendPartial(const void* data, size_t size)
+{
+    if (getState() != State::Connected || sendSendQueue())
+        return 0;
+    size_t done = 0;
+    while(done < size)
+    {
+        size_t result = _send(static_cast<const char*>(data) + done, size - done);
+        if (result == 0)
+            break;
+        done += result;
+    }
+    return done;
+}
+
 size_t StreamSocket::receive(void* data, size_t size)
 {
     sendSendQueue();
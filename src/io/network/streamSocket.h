@@ -25,6 +25,9 @@ public:
 
     void send(const void* data, size_t size);
     void queue(const void* data, size_t size);
+    //Send what the socket takes right now, and return the number of bytes sent. The rest is not queued.
+    //  Nothing is sent while there is queued data, so this stays in order with send() and queue().
+    size_t sendPartial(const void* data, size_t size);
     size_t receive(void* data, size_t size);
 
     void send(const io::DataBuffer& buffer);
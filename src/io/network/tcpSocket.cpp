@@ -1,9 +1,11 @@
 #include <io/network/tcpSocket.h>
 #include <logging.h>
+#include <algorithm>
 
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <io.h>
 static constexpr int flags = 0;
 
 static inline int send(SOCKET s, const void* msg, size_t len, int flags)
@@ -25,6 +27,9 @@ static inline int recv(SOCKET s, void* buf, size_t len, int flags)
 #include <arpa/inet.h>
 #include <string.h>
 #include <poll.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 #if defined(__APPLE__)
 static constexpr int flags = 0;
 #else
@@ -33,6 +38,21 @@ static constexpr int flags = MSG_NOSIGNAL;
 static constexpr intptr_t INVALID_SOCKET = -1;
 #endif
 
+#ifdef _WIN32
+static void closeHandle(SOCKET handle)
+{
+    closesocket(handle);
+}
+#else
+static void closeHandle(intptr_t handle)
+{
+    ::close(handle);
+}
+#endif
+
+//How long a connect attempt gets before the next address of the host is tried next to it (RFC 8305 recommends 250ms).
+static constexpr auto connect_attempt_delay = std::chrono::milliseconds(250);
+
 
 extern "C" {
     struct X509;
@@ -158,50 +178,140 @@ TcpSocket::~TcpSocket()
 
 bool TcpSocket::connect(const Address& host, int port)
 {
-    if (handle != INVALID_SOCKET)
-        close();
-    
-    for(const auto& addr_info : host.addr_info)
+    close();
+
+    if (blocking)
     {
-        handle = ::socket(addr_info.family, SOCK_STREAM, 0);
-        if (handle == INVALID_SOCKET)
-            return false;
-        setBlocking(blocking);
-        if (addr_info.family == AF_INET && sizeof(struct sockaddr_in) == addr_info.addr.size())
+        for(const auto& addr_info : host.addr_info)
         {
-            struct sockaddr_in server_addr;
-            memset(&server_addr, 0, sizeof(server_addr));
-            memcpy(&server_addr, addr_info.addr.data(), addr_info.addr.size());
-            server_addr.sin_port = htons(port);
-            if (::connect(handle, reinterpret_cast<const sockaddr*>(&server_addr), sizeof(server_addr)) == 0)
-                return true;
-            if (isLastErrorNonBlocking())
-            {
-                connecting = true;
+            if (startConnect(addr_info, port))
                 return true;
-            }
         }
-        if (addr_info.family == AF_INET6 && sizeof(struct sockaddr_in6) == addr_info.addr.size())
+        return false;
+    }
+
+    //Alternate between the address families, starting with the family the resolver put first.
+    std::list<Address::AddrInfo> first, second;
+    for(const auto& addr_info : host.addr_info)
+    {
+        if (addr_info.family == host.addr_info.front().family)
+            first.push_back(addr_info);
+        else
+            second.push_back(addr_info);
+    }
+    while(!first.empty() || !second.empty())
+    {
+        if (!first.empty())
+            connect_queue.splice(connect_queue.end(), first, first.begin());
+        if (!second.empty())
+            connect_queue.splice(connect_queue.end(), second, second.begin());
+    }
+    connect_port = port;
+    connecting = true;
+    next_connect_attempt_time = std::chrono::steady_clock::now();
+    updateConnect();
+    return connecting || handle != INVALID_SOCKET;
+}
+
+//Create the socket in handle and start connecting it. Returns true when connected, or when still connecting on a non-blocking socket.
+bool TcpSocket::startConnect(const Address::AddrInfo& addr_info, int port)
+{
+    handle = ::socket(addr_info.family, SOCK_STREAM, 0);
+    if (handle == INVALID_SOCKET)
+        return false;
+    setBlocking(blocking);
+    int result = -1;
+    if (addr_info.family == AF_INET && sizeof(struct sockaddr_in) == addr_info.addr.size())
+    {
+        struct sockaddr_in server_addr;
+        memset(&server_addr, 0, sizeof(server_addr));
+        memcpy(&server_addr, addr_info.addr.data(), addr_info.addr.size());
+        server_addr.sin_port = htons(port);
+        result = ::connect(handle, reinterpret_cast<const sockaddr*>(&server_addr), sizeof(server_addr));
+    }
+    if (addr_info.family == AF_INET6 && sizeof(struct sockaddr_in6) == addr_info.addr.size())
+    {
+        struct sockaddr_in6 server_addr;
+        memset(&server_addr, 0, sizeof(server_addr));
+        memcpy(&server_addr, addr_info.addr.data(), addr_info.addr.size());
+        server_addr.sin6_port = htons(port);
+        result = ::connect(handle, reinterpret_cast<const sockaddr*>(&server_addr), sizeof(server_addr));
+    }
+    if (result == 0 || isLastErrorNonBlocking())
+        return true;
+    closeHandle(handle);
+    handle = INVALID_SOCKET;
+    return false;
+}
+
+void TcpSocket::updateConnect()
+{
+    auto now = std::chrono::steady_clock::now();
+    if (!connect_attempts.empty())
+    {
+        auto& fds = connect_poll_fds;
+        fds.resize(connect_attempts.size());
+        for(size_t n=0; n<connect_attempts.size(); n++)
         {
-            struct sockaddr_in6 server_addr;
-            memset(&server_addr, 0, sizeof(server_addr));
-            memcpy(&server_addr, addr_info.addr.data(), addr_info.addr.size());
-            server_addr.sin6_port = htons(port);
-            if (::connect(handle, reinterpret_cast<const sockaddr*>(&server_addr), sizeof(server_addr)) == 0)
-                return true;
-            if (isLastErrorNonBlocking())
+            fds[n].fd = connect_attempts[n];
+            fds[n].events = POLLOUT;
+            fds[n].revents = 0;
+        }
+#ifdef WIN32
+        if (WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), 0) > 0)
+#else
+        if (poll(fds.data(), fds.size(), 0) > 0)
+#endif
+        {
+            for(size_t n=connect_attempts.size(); n-- > 0; )
             {
-                connecting = true;
-                return true;
+                if (!fds[n].revents)
+                    continue;
+                struct sockaddr_in6 server_addr;
+                socklen_t server_addr_len = sizeof(server_addr);
+                if (getpeername(connect_attempts[n], reinterpret_cast<sockaddr*>(&server_addr), &server_addr_len) == 0)
+                {
+                    handle = connect_attempts[n];
+                    connect_attempts.erase(connect_attempts.begin() + n);
+                    for(auto attempt : connect_attempts)
+                        closeHandle(attempt);
+                    connect_attempts.clear();
+                    connect_queue.clear();
+                    connecting = false;
+                    setBlocking(blocking);
+                    return;
+                }
+                //Failed, no need to wait before trying the next address.
+                closeHandle(connect_attempts[n]);
+                connect_attempts.erase(connect_attempts.begin() + n);
+                next_connect_attempt_time = now;
             }
         }
-        close();
     }
-    return false;
+
+    while(!connect_queue.empty() && now >= next_connect_attempt_time)
+    {
+        auto addr_info = std::move(connect_queue.front());
+        connect_queue.pop_front();
+        if (startConnect(addr_info, connect_port))
+        {
+            connect_attempts.push_back(handle);
+            handle = INVALID_SOCKET;
+            next_connect_attempt_time = now + connect_attempt_delay;
+        }
+    }
+    if (connect_attempts.empty() && connect_queue.empty())
+        connecting = false;
 }
 
 bool TcpSocket::connectSSL(const Address& host, int port)
 {
+    //The SSL handshake below needs the connection to be established, so it only works on blocking sockets.
+    if (!blocking)
+    {
+        LOG(Warning, "Failed to connect SSL socket, non-blocking SSL connects are not supported");
+        return false;
+    }
     if (!connect(host, port))
         return false;
     initializeLibSSL();
@@ -245,15 +355,15 @@ void TcpSocket::setDelay(bool delay)
 
 void TcpSocket::close()
 {
+    for(auto attempt : connect_attempts)
+        closeHandle(attempt);
+    connect_attempts.clear();
+    connect_queue.clear();
+    connecting = false;
     if (handle != INVALID_SOCKET)
     {
-#ifdef _WIN32
-        closesocket(handle);
-#else
-        ::close(handle);
-#endif
+        closeHandle(handle);
         handle = INVALID_SOCKET;
-        connecting = false;
         clearQueue();
         if (ssl_handle)
             SSL_free(static_cast<SSL*>(ssl_handle));
@@ -263,31 +373,14 @@ void TcpSocket::close()
 
 StreamSocket::State TcpSocket::getState()
 {
+    if (connecting)
+    {
+        updateConnect();
+        if (connecting)
+            return StreamSocket::State::Connecting;
+    }
     if (handle == INVALID_SOCKET)
         return StreamSocket::State::Closed;
-    if (connecting) {
-        struct pollfd fds;
-        fds.fd = handle;
-        fds.events = POLLOUT;
-        fds.revents = 0;
-#ifdef WIN32
-        if (WSAPoll(&fds, 1, 0))
-#else
-        if (poll(&fds, 1, 0))
-#endif
-        {
-            struct sockaddr_in6 server_addr;
-            socklen_t server_addr_len = sizeof(server_addr);
-            if (getpeername(handle, reinterpret_cast<sockaddr*>(&server_addr), &server_addr_len))
-            {
-                close();
-                return StreamSocket::State::Closed;
-            }
-            connecting = false;
-            return StreamSocket::State::Connected;
-        }
-        return StreamSocket::State::Connecting;
-    }
     return StreamSocket::State::Connected;
 }
 
@@ -307,6 +400,47 @@ size_t TcpSocket::_send(const void* data, size_t size)
     return result;
 }
 
+bool TcpSocket::sendFile(int file_descriptor, uint64_t offset, size_t size, size_t& sent)
+{
+    sent = 0;
+    if (size == 0 || getState() != State::Connected || sendSendQueue())
+        return true;
+#if defined(__linux__)
+    if (!ssl_handle)
+    {
+        off_t file_offset = static_cast<off_t>(offset);
+        auto result = ::sendfile(handle, file_descriptor, &file_offset, size);
+        if (result < 0)
+        {
+            //A full socket and a failed read look the same here, so ask the file whether it still has data at the offset.
+            if (!isLastErrorNonBlocking())
+            {
+                close();
+                return true;
+            }
+            char byte;
+            return ::pread(file_descriptor, &byte, 1, static_cast<off_t>(offset)) == 1;
+        }
+        //Nothing sent without an error means the file ended.
+        sent = result;
+        return result > 0;
+    }
+#endif
+    char buffer[16 * 1024];
+#ifdef _WIN32
+    if (_lseeki64(file_descriptor, offset, SEEK_SET) < 0)
+        return false;
+    auto read_size = _read(file_descriptor, buffer, static_cast<unsigned int>(std::min(size, sizeof(buffer))));
+#else
+    auto read_size = ::pread(file_descriptor, buffer, std::min(size, sizeof(buffer)), static_cast<off_t>(offset));
+#endif
+    if (read_size <= 0)
+        return false;
+    //What the socket does not take now is read from the file again on the next call, so nothing ends up in the send queue.
+    sent = _send(buffer, read_size);
+    return true;
+}
+
 size_t TcpSocket::_receive(void* data, size_t size)
 {
     int result;
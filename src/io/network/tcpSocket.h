@@ -5,7 +5,10 @@
 #include <io/network/socketBase.h>
 #include <io/network/streamSocket.h>
 #include <io/dataBuffer.h>
+#include <chrono>
+#include <vector>
 
+struct pollfd;
 
 namespace sp {
 namespace io {
@@ -18,9 +21,17 @@ public:
     TcpSocket();
     ~TcpSocket();
 
+    //On a non-blocking socket this only starts connecting, getState() reports Connecting till it is done.
+    //  When the host has multiple addresses, these are tried in parallel with IPv6 and IPv4 interleaved, each next
+    //  address is started when the previous one did not connect within 250ms. The first that connects is used.
     bool connect(const Address& host, int port);
+    //Always blocks till the connection and the SSL handshake are done, fails on a non-blocking socket.
     bool connectSSL(const Address& host, int port);
     void setDelay(bool delay); //Enable of disable the NO_DELAY/Nagle algorithm, allowing for less latency at the cost of more packets.
+    //Send up to size bytes from an open file descriptor, starting at offset. The data does not pass through userspace where the OS supports it.
+    //  sent is the number of bytes sent, 0 when the socket cannot take more data right now. Queued data is sent first.
+    //  Returns false when the file could not be read, which includes a file that ends before offset + size.
+    bool sendFile(int file_descriptor, uint64_t offset, size_t size, size_t& sent);
     virtual void close() override;
 
     virtual State getState() override;
@@ -30,8 +41,17 @@ protected:
     virtual size_t _receive(void* data, size_t size) override;
 
 private:
+    bool startConnect(const Address::AddrInfo& addr_info, int port);
+    void updateConnect();
+
     void* ssl_handle;
     bool connecting = false;
+    //Addresses that are not tried yet, and the sockets of the attempts that are running, while connecting non-blocking.
+    std::list<Address::AddrInfo> connect_queue;
+    std::vector<decltype(handle)> connect_attempts;
+    std::vector<struct pollfd> connect_poll_fds; //Kept, as getState() polls the attempts on every call while connecting.
+    int connect_port = 0;
+    std::chrono::steady_clock::time_point next_connect_attempt_time;
 
     friend class TcpListener;
 };
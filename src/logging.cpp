@@ -1,28 +1,22 @@
 #include "logging.h"
 
 #include <SDL_log.h>
+#include <algorithm>
 #include <array>
-#include <string>
-
-#ifdef WIN32
-// Windows/SDL quirk (2.0.14):
-//  On Win32 write access is exclusive with SDL's implementation:
-//  https://github.com/libsdl-org/SDL/blob/4cd981609b50ed273d80c635c1ca4c1e5518fb21/src/file/SDL_rwops.c#L122
-//  And by default (ie - public binaries) the STDIO interface is compiled out on win32.
-//  Since this prevents someone to `tail` the log while the game is running,
-//  fallback on cstdio on windows.
-#define SP_LOGGING_FALLBACK_STDIO 1
-#else
-#define SP_LOGGING_FALLBACK_STDIO 0
-#endif
-
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdio>
-#include <SDL_rwops.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 
 
 namespace
 {
-    const std::array<std::string, SDL_NUM_LOG_PRIORITIES> priority_labels{
+    const std::array<std::string_view, SDL_NUM_LOG_PRIORITIES> priority_labels{
         "[UNKNOWN ]: ",
         "[VERBOSE ]: ",
         "[DEBUG   ]: ",
@@ -32,33 +26,6 @@ namespace
         "[CRITICAL]: "
     };
 
-    void stdioCallback(void* userdata, int /*category*/, SDL_LogPriority priority, const char* message)
-    {
-        auto stream = static_cast<FILE*>(userdata);
-        auto write = [stream](const void* buffer, size_t size, size_t num)
-        {
-            return fwrite(buffer, size, num, stream);
-        };
-        const auto& label = priority_labels[priority];
-        write(label.data(), label.size(), 1);
-        write(message, SDL_strlen(message), 1);
-        write("\n", 1, 1);
-        fflush(stream);
-    }
-
-    void sdlCallback(void* userdata, int /*category*/, SDL_LogPriority priority, const char* message)
-    {
-        auto stream = static_cast<SDL_RWops*>(userdata);
-        auto write = [stream](const void* buffer, size_t size, size_t num)
-        {
-            return SDL_RWwrite(stream, buffer, size, num);
-        };
-        const auto& label = priority_labels[priority];
-        write(label.data(), label.size(), 1);
-        write(message, SDL_strlen(message), 1);
-        write("\n", 1, 1);
-    }
-
     constexpr SDL_LogPriority asSDLPriority(ELogLevel level)
     {
         auto priority = SDL_LOG_PRIORITY_VERBOSE;
@@ -80,47 +47,325 @@ namespace
 
         return priority;
     }
+
+    /**
+        Writes log messages on a background thread.
+        Messages are passed through a bounded multi producer, single consumer ring, so logging threads never wait on a lock or on IO.
+        When the ring is full, debug and info messages are dropped and counted, warnings and errors wait for room.
+        Files are written with cstdio, as SDL_RWops has exclusive write access on windows, which prevents someone to `tail` the log while the game is running.
+     */
+    class LogWriter
+    {
+    public:
+        static LogWriter& get()
+        {
+            //Never destroyed, messages logged by static destructors after shutdown() are written directly.
+            static LogWriter* instance = new LogWriter();
+            return *instance;
+        }
+
+        void push(SDL_LogPriority priority, std::string_view message)
+        {
+            if (synchronous)
+            {
+                std::lock_guard<std::mutex> lock(sink_mutex);
+                std::string text;
+                write(priority, message, text);
+                if (!text.empty())
+                    writeBatch(text);
+                return;
+            }
+
+            size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+            Message* slot;
+            while(true)
+            {
+                slot = &queue[pos & (queue_size - 1)];
+                auto sequence = slot->sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+                if (diff == 0)
+                {
+                    if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (diff < 0)
+                {
+                    if (priority < SDL_LOG_PRIORITY_WARN)
+                    {
+                        dropped++;
+                        return;
+                    }
+                    wake();
+                    std::this_thread::yield();
+                    pos = enqueue_pos.load(std::memory_order_relaxed);
+                }
+                else
+                {
+                    pos = enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            slot->priority = priority;
+            slot->text.assign(message.data(), message.size());
+            slot->sequence.store(pos + 1);
+            if (sleeping)
+                wake();
+        }
+
+        void flush()
+        {
+            if (synchronous)
+                return;
+            auto target = enqueue_pos.load();
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.notify_one();
+            done.wait(lock, [this, target]() { return written >= target; });
+        }
+
+        void setFile(FILE* new_file, std::string_view new_filename)
+        {
+            std::lock_guard<std::mutex> lock(sink_mutex);
+            closeFile();
+            file = new_file;
+            filename = new_filename;
+            file_size = 0;
+        }
+
+        void setRotation(size_t max_size, int keep)
+        {
+            std::lock_guard<std::mutex> lock(sink_mutex);
+            max_file_size = max_size;
+            keep_files = keep;
+        }
+    private:
+        static constexpr size_t queue_size = 4096;
+
+        struct Message
+        {
+            std::atomic<size_t> sequence;
+            SDL_LogPriority priority;
+            std::string text;
+        };
+
+        LogWriter()
+        : queue(new Message[queue_size])
+        {
+            for(size_t n=0; n<queue_size; n++)
+                queue[n].sequence = n;
+            //Messages that SDL logs itself go through the same queue, the original output function is used when there is no log file.
+            SDL_LogGetOutputFunction(&default_output, &default_output_data);
+            SDL_LogSetOutputFunction(&sdlCallback, this);
+            thread = std::thread(&LogWriter::run, this);
+            atexit(&LogWriter::shutdown);
+        }
+
+        static void sdlCallback(void* userdata, int /*category*/, SDL_LogPriority priority, const char* message)
+        {
+            static_cast<LogWriter*>(userdata)->push(priority, message);
+        }
+
+        static void shutdown()
+        {
+            auto& writer = get();
+            writer.synchronous = true;
+            {
+                std::lock_guard<std::mutex> lock(writer.mutex);
+                writer.quit = true;
+                writer.wakeup.notify_one();
+            }
+            writer.thread.join();
+        }
+
+        void wake()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            wakeup.notify_one();
+        }
+
+        void run()
+        {
+            std::string batch;
+            while(true)
+            {
+                batch.clear();
+                {
+                    std::lock_guard<std::mutex> lock(sink_mutex);
+                    auto drop_count = dropped.exchange(0);
+                    if (drop_count)
+                        write(SDL_LOG_PRIORITY_WARN, "Log queue full, dropped " + std::to_string(drop_count) + " messages", batch);
+                    while(true)
+                    {
+                        auto& slot = queue[dequeue_pos & (queue_size - 1)];
+                        if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos + 1)
+                            break;
+                        write(slot.priority, slot.text, batch);
+                        slot.sequence.store(dequeue_pos + queue_size, std::memory_order_release);
+                        dequeue_pos++;
+                    }
+                    if (!batch.empty())
+                        writeBatch(batch);
+                }
+
+                std::unique_lock<std::mutex> lock(mutex);
+                written = dequeue_pos;
+                done.notify_all();
+                sleeping = true;
+                auto pending = [this]() { return queue[dequeue_pos & (queue_size - 1)].sequence.load() == dequeue_pos + 1; };
+                if (!pending())
+                {
+                    if (quit)
+                        break;
+                    wakeup.wait_for(lock, std::chrono::milliseconds(100));
+                }
+                sleeping = false;
+            }
+        }
+
+        //Called with the sink_mutex locked. Appends the message to the batch for file output, or passes it to the SDL output directly.
+        void write(SDL_LogPriority priority, std::string_view message, std::string& batch)
+        {
+            if (!file)
+            {
+                if (default_output)
+                {
+                    std::string text(message);
+                    default_output(default_output_data, SDL_LOG_CATEGORY_APPLICATION, priority, text.c_str());
+                }
+                return;
+            }
+            batch += priority_labels[priority];
+            batch += message;
+            batch += '\n';
+        }
+
+        void writeBatch(const std::string& batch)
+        {
+            fwrite(batch.data(), batch.size(), 1, file);
+            fflush(file);
+            file_size += batch.size();
+            if (max_file_size && file_size >= max_file_size && file != stdout)
+                rotate();
+        }
+
+        void rotate()
+        {
+            closeFile();
+            for(int n=keep_files - 1; n>0; n--)
+            {
+                auto from = filename + "." + std::to_string(n);
+                auto to = filename + "." + std::to_string(n + 1);
+                std::remove(to.c_str());
+                std::rename(from.c_str(), to.c_str());
+            }
+            auto first = filename + ".1";
+            std::remove(first.c_str());
+            if (keep_files > 0)
+                std::rename(filename.c_str(), first.c_str());
+            file = fopen(filename.c_str(), "wt");
+            file_size = 0;
+        }
+
+        void closeFile()
+        {
+            if (file && file != stdout)
+                fclose(file);
+            file = nullptr;
+        }
+
+        std::unique_ptr<Message[]> queue;
+        std::atomic<size_t> enqueue_pos{0};
+        size_t dequeue_pos = 0;
+        std::atomic<uint64_t> dropped{0};
+
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        std::condition_variable done;
+        std::atomic<bool> sleeping{false};
+        size_t written = 0;
+        bool quit = false;
+        std::atomic<bool> synchronous{false};
+        std::thread thread;
+
+        std::mutex sink_mutex;
+        FILE* file = nullptr;
+        std::string filename;
+        size_t file_size = 0;
+        size_t max_file_size = 0;
+        int keep_files = 0;
+        SDL_LogOutputFunction default_output = nullptr;
+        void* default_output_data = nullptr;
+    };
+
+    //The buffer is a plain pointer, so messages logged from destructors that run after the thread locals are destroyed still have a buffer.
+    thread_local std::string* format_buffer = nullptr;
+    struct FormatBufferCleanup
+    {
+        ~FormatBufferCleanup() { delete format_buffer; format_buffer = nullptr; }
+    };
+
+    std::string& formatBuffer()
+    {
+        if (!format_buffer)
+        {
+            thread_local FormatBufferCleanup cleanup;
+            format_buffer = new std::string();
+            format_buffer->reserve(1024);
+        }
+        return *format_buffer;
+    }
+
+    template<typename T> const Logging& appendNumber(const Logging& log, T value)
+    {
+        char buffer[32];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        return log << std::string_view(buffer, result.ptr - buffer);
+    }
 }
 
 ELogLevel Logging::global_level = LOGLEVEL_ERROR;
 
-Logging::Logging(ELogLevel in_level, std::string_view file, int /*line*/, std::string_view function_name)
-    :do_logging{in_level >= global_level}, level{in_level}
+Logging::Logging(ELogLevel in_level, std::string_view /*file*/, int /*line*/, std::string_view /*function_name*/)
+    :do_logging{isEnabled(in_level)}, start{0}, level{in_level}
 {
+    if (do_logging)
+        start = formatBuffer().size();
 }
 
 Logging::~Logging()
 {
     if (do_logging)
     {
-        auto sdl_level = SDL_LOG_PRIORITY_VERBOSE;
-        switch (level)
-        {
-        case LOGLEVEL_DEBUG:
-            sdl_level = SDL_LOG_PRIORITY_DEBUG;
-            break;
-        case LOGLEVEL_INFO:
-            sdl_level = SDL_LOG_PRIORITY_INFO;
-            break;
-        case LOGLEVEL_WARNING:
-            sdl_level = SDL_LOG_PRIORITY_WARN;
-            break;
-        case LOGLEVEL_ERROR:
-            sdl_level = SDL_LOG_PRIORITY_ERROR;
-            break;
-        }
-
-        SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, sdl_level, "%s", stream.str().c_str());
+        auto& buffer = formatBuffer();
+        LogWriter::get().push(asSDLPriority(level), std::string_view(buffer).substr(start));
+        buffer.resize(start);
     }
 }
 
-const Logging& operator<<(const Logging& log, const char* str)
+const Logging& operator<<(const Logging& log, std::string_view str)
 {
     if (log.do_logging)
-        log.stream << str;
+        formatBuffer() += str;
     return log;
 }
 
+const Logging& operator<<(const Logging& log, const int i) { return appendNumber(log, i); }
+const Logging& operator<<(const Logging& log, const unsigned int i) { return appendNumber(log, i); }
+const Logging& operator<<(const Logging& log, const long i) { return appendNumber(log, i); }
+const Logging& operator<<(const Logging& log, const unsigned long i) { return appendNumber(log, i); }
+const Logging& operator<<(const Logging& log, const long long i) { return appendNumber(log, i); }
+const Logging& operator<<(const Logging& log, const unsigned long long i) { return appendNumber(log, i); }
+
+const Logging& operator<<(const Logging& log, const float f)
+{
+    char buffer[64];
+    int length = snprintf(buffer, sizeof(buffer), "%.2f", f);
+    return log << std::string_view(buffer, std::max(0, std::min(length, int(sizeof(buffer)) - 1)));
+}
+
+const Logging& operator<<(const Logging& log, const double f)
+{
+    return log << float(f);
+}
+
 void Logging::setLogLevel(ELogLevel level)
 {
     global_level = level;
@@ -129,35 +374,21 @@ void Logging::setLogLevel(ELogLevel level)
 
 void Logging::setLogFile(std::string_view filename)
 {
-    closeCurrentLogStream();
-
-#if SP_LOGGING_FALLBACK_STDIO
-    auto handle = fopen(filename.data(), "wt");
-    SDL_LogSetOutputFunction(&stdioCallback, handle);
-#else
-    auto handle = SDL_RWFromFile(filename.data(), "wt");
-    SDL_LogSetOutputFunction(&sdlCallback, handle);
-#endif
+    std::string name(filename);
+    LogWriter::get().setFile(fopen(name.c_str(), "wt"), name);
+}
+
+void Logging::setLogRotation(size_t max_file_size, int keep_files)
+{
+    LogWriter::get().setRotation(max_file_size, keep_files);
 }
 
 void Logging::setLogStdout()
 {
-    closeCurrentLogStream();
-    SDL_LogSetOutputFunction(&stdioCallback, stdout);
+    LogWriter::get().setFile(stdout, "");
 }
 
-void Logging::closeCurrentLogStream()
+void Logging::flush()
 {
-    SDL_LogOutputFunction current = nullptr;
-    void* current_data = nullptr;
-    SDL_LogGetOutputFunction(&current, &current_data);
-    if (current == &stdioCallback) {
-        auto stream = static_cast<FILE*>(current_data);
-        if (stream != stdout)
-            fclose(stream);
-    }
-    if (current == &sdlCallback) {
-        auto stream = static_cast<SDL_RWops*>(current_data);
-        SDL_RWclose(stream);
-    }
-}
\ No newline at end of file
+    LogWriter::get().flush();
+}
@@ -1,15 +1,22 @@
 #ifndef LOGGING_H
 #define LOGGING_H
-#include <sstream>
+#include <string>
 #include <string_view>
 
 #include <glm/vec2.hpp>
 #include "nonCopyable.h"
 #include "stringImproved.h"
+
+//Messages below this level are removed at compile time, including the evaluation of their arguments.
+#ifndef SP_LOG_MIN_LEVEL
+#define SP_LOG_MIN_LEVEL 0
+#endif
+
+//The conditional skips the arguments of disabled messages. The & binds weaker than <<, so `LOG(Info) << a << b` still works, and the macro is a single expression.
 #if defined(_MSC_VER)
-#define LOG(LEVEL, ...) Logging{LOGLEVEL_ ## LEVEL, __FILE__, __LINE__, __FUNCTION__ , ##__VA_ARGS__}
+#define LOG(LEVEL, ...) !Logging::isEnabled(LOGLEVEL_ ## LEVEL) ? (void)0 : LoggingVoidify() & Logging{LOGLEVEL_ ## LEVEL, __FILE__, __LINE__, __FUNCTION__ , ##__VA_ARGS__}
 #else
-#define LOG(LEVEL, ...) Logging(LOGLEVEL_ ## LEVEL, __FILE__, __LINE__, __PRETTY_FUNCTION__ , ##__VA_ARGS__)
+#define LOG(LEVEL, ...) !Logging::isEnabled(LOGLEVEL_ ## LEVEL) ? (void)0 : LoggingVoidify() & Logging(LOGLEVEL_ ## LEVEL, __FILE__, __LINE__, __PRETTY_FUNCTION__ , ##__VA_ARGS__)
 #endif
 
 enum ELogLevel
@@ -25,11 +32,15 @@ enum ELogLevel
     LOGLEVEL_Error
 };
 
+/**
+    A single log message. Formatted into a per thread buffer, and handed to a background thread that does the actual writing,
+    so logging does not block the calling thread on file IO.
+ */
 class Logging : sp::NonCopyable
 {
     static ELogLevel global_level;
     bool do_logging;
-    mutable std::ostringstream stream;
+    size_t start;   //Offset of this message in the per thread buffer, an argument of a message can log a message of its own.
     ELogLevel level;
 public:
     Logging(ELogLevel level, std::string_view file, int line, std::string_view function_name);
@@ -40,26 +51,36 @@ public:
         ((*this << args), ...);
     }
     ~Logging();
-    
+
+    static bool isEnabled(ELogLevel level) { return level >= SP_LOG_MIN_LEVEL && level >= global_level; }
+
     static void setLogLevel(ELogLevel level);
     static void setLogFile(std::string_view filename);
+    //Rename the log file to filename.1 (and older ones to .2, .3...) when it grows beyond max_file_size. 0 disables rotation.
+    static void setLogRotation(size_t max_file_size, int keep_files);
     static void setLogStdout();
-    
-    friend const Logging& operator<<(const Logging& log, const char* str);
+    //Wait till all messages logged so far are written.
+    static void flush();
+
+    friend const Logging& operator<<(const Logging& log, std::string_view str);
+};
 
-private:
-    static void closeCurrentLogStream();
+struct LoggingVoidify
+{
+    void operator&(const Logging&) {}
 };
 
-const Logging& operator<<(const Logging& log, const char* str);
-inline const Logging& operator<<(const Logging& log, const std::string& s) { return log << (s.c_str()); }
-inline const Logging& operator<<(const Logging& log, const int i) { return log << string(i).c_str(); }
-inline const Logging& operator<<(const Logging& log, const unsigned int i) { return log << string(i).c_str(); }
-inline const Logging& operator<<(const Logging& log, const long i) { return log << string(int(i)).c_str(); }
-inline const Logging& operator<<(const Logging& log, const unsigned long i) { return log << string(int(i)).c_str(); }
-inline const Logging& operator<<(const Logging& log, const float f) { return log << string(f).c_str(); }
-inline const Logging& operator<<(const Logging& log, const double f) { return log << string(float(f), 2).c_str(); }
-inline const Logging& operator<<(const Logging& log, const unsigned long long i) { return log << string(int(i)).c_str(); }
+const Logging& operator<<(const Logging& log, std::string_view str);
+const Logging& operator<<(const Logging& log, const int i);
+const Logging& operator<<(const Logging& log, const unsigned int i);
+const Logging& operator<<(const Logging& log, const long i);
+const Logging& operator<<(const Logging& log, const unsigned long i);
+const Logging& operator<<(const Logging& log, const long long i);
+const Logging& operator<<(const Logging& log, const unsigned long long i);
+const Logging& operator<<(const Logging& log, const float f);
+const Logging& operator<<(const Logging& log, const double f);
+inline const Logging& operator<<(const Logging& log, const char* str) { return log << std::string_view(str); }
+inline const Logging& operator<<(const Logging& log, const std::string& s) { return log << std::string_view(s); }
 template<typename T, glm::qualifier Q> inline const Logging& operator<<(const Logging& log, const glm::vec<2, T, Q> v) { return log << v.x << "," << v.y; }
 
 #endif//LOGGING_H
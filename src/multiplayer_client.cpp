@@ -14,6 +14,21 @@ P<GameClient> game_client;
 
 GameClient::GameClient(int version_number, sp::io::network::Address server, int port_nr)
 : version_number(version_number), server(server), port_nr(port_nr)
+{
+    initialize();
+    connect();
+}
+
+GameClient::GameClient(int version_number, const string& hostname, int port_nr)
+: version_number(version_number), port_nr(port_nr)
+{
+    initialize();
+    resolving_server = sp::io::network::Address::resolve(hostname);
+    //Not connected yet, so anything sent before the connection is started is dropped, like while connecting.
+    socket = std::make_unique<sp::io::network::TcpSocket>();
+}
+
+void GameClient::initialize()
 {
     SDL_assert(!game_server);
     SDL_assert(!game_client);
@@ -24,6 +39,10 @@ GameClient::GameClient(int version_number, sp::io::network::Address server, int
 
     no_data_timeout.start(no_data_disconnect_time);
     heartbeat_timer.start(heartbeat_time);
+}
+
+void GameClient::connect()
+{
     auto sock = std::make_unique<sp::io::network::TcpSocket>();
     sock->setBlocking(false);
     sock->connect(server, port_nr);
@@ -33,15 +52,7 @@ GameClient::GameClient(int version_number, sp::io::network::Address server, int
 #ifdef STEAMSDK
 GameClient::GameClient(int version_number, uint64_t steam_id)
 {
-    SDL_assert(!game_server);
-    SDL_assert(!game_client);
-
-    client_id = -1;
-    game_client = this;
-    status = Connecting;
-
-    no_data_timeout.start(no_data_disconnect_time);
-    heartbeat_timer.start(heartbeat_time);
+    initialize();
     auto sock = std::make_unique<sp::io::network::SteamP2PSocket>();
     sock->connect(steam_id);
     socket = std::move(sock);
@@ -65,6 +76,21 @@ void GameClient::update(float /*delta*/)
         return;
     if (status == Connecting)
     {
+        if (resolving_server.valid())
+        {
+            if (resolving_server.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                return;
+            server = resolving_server.get();
+            resolving_server = {};
+            if (server.getHumanReadable().empty())
+            {
+                status = Disconnected;
+                disconnect_reason = DisconnectReason::FailedToConnect;
+                LOG(INFO) << "GameClient: Failed to resolve server address";
+                return;
+            }
+            connect();
+        }
         switch(socket->getState())
         {
         case sp::io::network::StreamSocket::State::Closed:
@@ -10,6 +10,7 @@
 
 #include <stdint.h>
 #include <thread>
+#include <future>
 
 
 class GameClient;
@@ -49,6 +50,8 @@ private:
     int version_number;
     sp::io::network::Address server;
     int port_nr;
+    //Valid while the hostname of the server is being resolved, the status is Connecting during that time.
+    std::shared_future<sp::io::network::Address> resolving_server;
 
     std::unique_ptr<sp::io::network::StreamSocket> socket;
     std::unordered_map<int32_t, P<MultiplayerObject> > objectMap;
@@ -61,6 +64,8 @@ private:
     DisconnectReason disconnect_reason{ DisconnectReason::Unknown };
 public:
     GameClient(int version_number, sp::io::network::Address server, int port_nr = defaultServerPort);
+    //Resolves the hostname in the background, so creating the client never blocks on DNS.
+    GameClient(int version_number, const string& hostname, int port_nr = defaultServerPort);
 #ifdef STEAMSDK
     GameClient(int version_number, uint64_t steam_id);
 #endif
@@ -71,11 +76,16 @@ public:
 
     int32_t getClientId() { return client_id; }
     Status getStatus() { return status; }
+    //True while still looking up the address of the server, before the connection is started.
+    bool isResolving() const { return resolving_server.valid(); }
     DisconnectReason getDisconnectReason() const { return disconnect_reason; }
 
     void sendPacket(sp::io::DataBuffer& packet);
 
     void sendPassword(string password);
+private:
+    void initialize();
+    void connect();
 };
 
 #endif//MULTIPLAYER_CLIENT_H
@@ -0,0 +1,306 @@
+#include "profiler.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+
+namespace sp {
+namespace profiler {
+
+namespace {
+static constexpr size_t ring_size = 1 << 15;
+static constexpr size_t history_size = 300;
+
+struct Event
+{
+    uint64_t start;
+    uint64_t end;
+    uint32_t zone;
+};
+
+struct ThreadBuffer
+{
+    std::unique_ptr<Event[]> events{new Event[ring_size]};
+    std::atomic<uint64_t> head{0};
+    uint64_t processed = 0;
+    uint32_t thread_index = 0;
+    bool in_use = true;
+};
+
+struct ZoneInfo
+{
+    const char* name;
+    const char* category;
+    string display;
+    std::vector<float> history;
+    size_t history_next = 0;
+    float last = 0.0f;
+};
+
+struct State
+{
+    std::mutex mutex;
+    std::vector<ZoneInfo> zones;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::vector<uint64_t> frame_totals;
+    uint64_t last_frame_end = 0;
+};
+
+//Function local, as zones are registered from static initializers in other translation units.
+State& state()
+{
+    static State instance;
+    return instance;
+}
+
+uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//Buffers of threads that exit are reused by the next new thread, so short lived threads do not leak buffers.
+struct ThreadBufferHolder
+{
+    ThreadBuffer* buffer = nullptr;
+
+    ~ThreadBufferHolder()
+    {
+        if (!buffer)
+            return;
+        std::lock_guard<std::mutex> lock(state().mutex);
+        buffer->in_use = false;
+    }
+
+    ThreadBuffer& get()
+    {
+        if (buffer)
+            return *buffer;
+        auto& s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for(auto& b : s.buffers)
+        {
+            if (!b->in_use)
+            {
+                b->in_use = true;
+                buffer = b.get();
+                return *buffer;
+            }
+        }
+        s.buffers.emplace_back(std::make_unique<ThreadBuffer>());
+        buffer = s.buffers.back().get();
+        buffer->thread_index = static_cast<uint32_t>(s.buffers.size() - 1);
+        return *buffer;
+    }
+};
+thread_local ThreadBufferHolder thread_buffer;
+
+void record(uint32_t zone_id, uint64_t start, uint64_t end)
+{
+    auto& buffer = thread_buffer.get();
+    auto head = buffer.head.load(std::memory_order_relaxed);
+    buffer.events[head & (ring_size - 1)] = {start, end, zone_id};
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+//First event still in the ring buffer that was not overwritten yet.
+uint64_t oldestEvent(uint64_t head)
+{
+    return head > ring_size ? head - ring_size : 0;
+}
+
+struct PointerPairHash
+{
+    size_t operator()(const std::pair<const char*, const char*>& key) const
+    {
+        return std::hash<const char*>()(key.first) ^ (std::hash<const char*>()(key.second) * 31);
+    }
+};
+
+void writeJsonString(std::ostream& stream, const char* str)
+{
+    stream << '"';
+    for(; *str; str++)
+    {
+        if (*str == '"' || *str == '\\')
+            stream << '\\' << *str;
+        else if (static_cast<unsigned char>(*str) < 0x20)
+            stream << ' ';
+        else
+            stream << *str;
+    }
+    stream << '"';
+}
+}
+
+Zone::Zone(const char* name, const char* category)
+: id(intern(name, category))
+{
+}
+
+uint32_t Zone::intern(const char* name, const char* category)
+{
+    thread_local std::unordered_map<std::pair<const char*, const char*>, uint32_t, PointerPairHash> cache;
+    auto key = std::make_pair(name, category);
+    auto it = cache.find(key);
+    if (it != cache.end())
+        return it->second;
+
+    auto& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    uint32_t id = 0;
+    for(; id < s.zones.size(); id++)
+        if (strcmp(s.zones[id].name, name) == 0 && strcmp(s.zones[id].category, category) == 0)
+            break;
+    if (id == s.zones.size())
+    {
+        ZoneInfo info;
+        info.name = name;
+        info.category = category;
+        info.display = *category ? string(category) + ":" + name : string(name);
+        s.zones.emplace_back(std::move(info));
+    }
+    cache[key] = id;
+    return id;
+}
+
+Scope::Scope(uint32_t zone_id)
+: zone_id(zone_id), start(now())
+{
+}
+
+Scope::~Scope()
+{
+    record(zone_id, start, now());
+}
+
+void endFrame()
+{
+    static const Zone frame_zone("frame");
+    auto& s = state();
+    auto end = now();
+    if (s.last_frame_end)
+        record(frame_zone.getId(), s.last_frame_end, end);
+    s.last_frame_end = end;
+
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.frame_totals.assign(s.zones.size(), 0);
+    for(auto& buffer : s.buffers)
+    {
+        auto head = buffer->head.load(std::memory_order_acquire);
+        for(auto n = std::max(buffer->processed, oldestEvent(head)); n < head; n++)
+        {
+            auto& event = buffer->events[n & (ring_size - 1)];
+            s.frame_totals[event.zone] += event.end - event.start;
+        }
+        buffer->processed = head;
+    }
+    for(size_t n=0; n<s.zones.size(); n++)
+    {
+        auto& zone = s.zones[n];
+        zone.last = static_cast<float>(s.frame_totals[n]) * 1.0e-9f;
+        if (zone.history.size() < history_size)
+            zone.history.push_back(zone.last);
+        else
+            zone.history[zone.history_next] = zone.last;
+        zone.history_next = (zone.history_next + 1) % history_size;
+    }
+}
+
+std::map<string, float> getLastFrame()
+{
+    auto& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    std::map<string, float> result;
+    for(auto& zone : s.zones)
+        if (zone.last > 0.0f)
+            result[zone.display] = zone.last;
+    return result;
+}
+
+std::vector<ZoneSummary> getSummary()
+{
+    auto& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    std::vector<ZoneSummary> result;
+    std::vector<float> sorted;
+    for(auto& zone : s.zones)
+    {
+        if (zone.history.empty())
+            continue;
+        sorted = zone.history;
+        std::sort(sorted.begin(), sorted.end());
+        auto percentile = [&sorted](float p) { return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * static_cast<float>(sorted.size())))]; };
+
+        ZoneSummary summary;
+        summary.name = zone.display;
+        summary.last = zone.last;
+        for(auto f : sorted)
+            summary.average += f;
+        summary.average /= static_cast<float>(sorted.size());
+        summary.p50 = percentile(0.50f);
+        summary.p95 = percentile(0.95f);
+        summary.p99 = percentile(0.99f);
+        summary.max = sorted.back();
+        result.emplace_back(std::move(summary));
+    }
+    return result;
+}
+
+bool exportChromeTrace(const string& filename)
+{
+    std::ofstream file(filename.c_str());
+    if (!file)
+    {
+        LOG(Error, "Failed to open ", filename, " for the profiler trace");
+        return false;
+    }
+    file << std::fixed;
+    file.precision(3);
+
+    auto& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    uint64_t base = std::numeric_limits<uint64_t>::max();
+    for(auto& buffer : s.buffers)
+    {
+        auto head = buffer->head.load(std::memory_order_acquire);
+        if (head > 0)
+            base = std::min(base, buffer->events[oldestEvent(head) & (ring_size - 1)].start);
+    }
+
+    file << "{\"traceEvents\":[";
+    bool first = true;
+    for(auto& buffer : s.buffers)
+    {
+        if (!first)
+            file << ",";
+        first = false;
+        file << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread_index << ",\"args\":{\"name\":\"thread " << buffer->thread_index << "\"}}";
+
+        auto head = buffer->head.load(std::memory_order_acquire);
+        for(auto n = oldestEvent(head); n < head; n++)
+        {
+            auto& event = buffer->events[n & (ring_size - 1)];
+            auto& zone = s.zones[event.zone];
+            file << ",\n{\"name\":";
+            writeJsonString(file, zone.name);
+            file << ",\"cat\":";
+            writeJsonString(file, *zone.category ? zone.category : "engine");
+            file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_index;
+            file << ",\"ts\":" << static_cast<double>(event.start - base) / 1000.0;
+            file << ",\"dur\":" << static_cast<double>(event.end - event.start) / 1000.0 << "}";
+        }
+    }
+    file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return bool(file);
+}
+
+}//namespace profiler
+}//namespace sp
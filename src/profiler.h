@@ -0,0 +1,81 @@
+#ifndef SP_PROFILER_H
+#define SP_PROFILER_H
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include "stringImproved.h"
+
+
+namespace sp {
+namespace profiler {
+
+/**
+    A named section of code that is measured by the profiler.
+    Zones with the same category and name share an id, so a zone can be declared as a static in a template or inline function.
+    The name and category are not copied and need to outlive the profiler, string literals or typeid().name() are fine.
+ */
+class Zone
+{
+public:
+    Zone(const char* name, const char* category="");
+
+    uint32_t getId() const { return id; }
+
+    //Lookup the zone for a name that is only known at runtime, like the type name of an object. Does not allocate after the first call with the same pointers.
+    static uint32_t intern(const char* name, const char* category="");
+private:
+    uint32_t id;
+};
+
+/**
+    Measures the time from construction till destruction as one event of a zone.
+    Events are stored in a ring buffer per thread, so scopes can be used on worker threads and nest freely.
+ */
+class Scope
+{
+public:
+    explicit Scope(const Zone& zone) : Scope(zone.getId()) {}
+    explicit Scope(uint32_t zone_id);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+private:
+    uint32_t zone_id;
+    uint64_t start;
+};
+
+struct ZoneSummary
+{
+    string name;        //"category:name", or just the name for zones without a category.
+    float last = 0.0f;  //Total time in the last frame, in seconds.
+    float average = 0.0f;
+    float p50 = 0.0f;
+    float p95 = 0.0f;
+    float p99 = 0.0f;
+    float max = 0.0f;
+};
+
+//Call once per frame from the main thread. Collects the events of all threads into the per zone frame totals, and records the frame itself as the "frame" zone.
+void endFrame();
+
+//Total time per zone that ran in the last frame, in seconds.
+std::map<string, float> getLastFrame();
+//Percentiles of the per frame totals of each zone over the last few seconds of frames, to find spikes that averages hide.
+std::vector<ZoneSummary> getSummary();
+
+//Write the events that are still in the ring buffers as a Chrome trace/Perfetto JSON file. Call between frames, from the main thread.
+bool exportChromeTrace(const string& filename);
+
+}//namespace profiler
+}//namespace sp
+
+#define SP_PROFILE_CONCAT_(a, b) a ## b
+#define SP_PROFILE_CONCAT(a, b) SP_PROFILE_CONCAT_(a, b)
+//Measure the rest of the current scope as the given zone name.
+#define SP_PROFILE_ZONE(...) \
+    static const sp::profiler::Zone SP_PROFILE_CONCAT(sp_profile_zone_, __LINE__){__VA_ARGS__}; \
+    sp::profiler::Scope SP_PROFILE_CONCAT(sp_profile_scope_, __LINE__){SP_PROFILE_CONCAT(sp_profile_zone_, __LINE__)}
+
+#endif//SP_PROFILER_H
@@ -0,0 +1,54 @@
+#ifndef RESOURCE_PACK_H
+#define RESOURCE_PACK_H
+
+#include <cstdint>
+#include <string_view>
+
+/**
+    File format of resource packs, as read by the PackResourceProvider and written by the sp_pack tool.
+    Layout: Header, Entry[entry_count] sorted on name_hash, the names of all entries (not zero terminated), file data.
+    All values are stored little endian.
+ */
+namespace sp::resourcepack {
+
+static constexpr char magic[4] = {'S', 'P', 'P', 'K'};
+static constexpr uint32_t version = 1;
+
+//Entry data is compressed with zstd, Entry::size is the uncompressed size.
+static constexpr uint32_t FlagZstd = 0x01;
+
+struct Header
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t names_size;
+};
+
+struct Entry
+{
+    uint64_t name_hash;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t stored_size;
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+//FNV-1a hash of the resource name.
+inline uint64_t hashName(std::string_view name)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(auto c : name)
+    {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+}//namespace sp::resourcepack
+
+#endif//RESOURCE_PACK_H
@@ -1,8 +1,13 @@
 #include "resources.h"
+#include "resourcePack.h"
+#include "io/mappedFile.h"
 
 #include <cstdio>
+#include <cstring>
+#include <algorithm>
 #include <filesystem>
 #include <SDL.h>
+#include <zstd/zstd.h>
 
 #ifdef ANDROID
 #include <jni.h>
@@ -204,6 +209,142 @@ std::vector<string> DirectoryResourceProvider::findResources(string searchPatter
     return found_files;
 }
 
+class MemoryResourceStream : public ResourceStream
+{
+    std::shared_ptr<sp::io::MappedFile> mapping; //Keeps the data alive for uncompressed entries.
+    std::unique_ptr<uint8_t[]> buffer;  //Owns the data for decompressed entries.
+    const uint8_t* data;
+    size_t size;
+    size_t position = 0;
+public:
+    MemoryResourceStream(std::shared_ptr<sp::io::MappedFile> mapping, const uint8_t* data, size_t size)
+    : mapping(mapping), data(data), size(size)
+    {
+    }
+
+    MemoryResourceStream(std::unique_ptr<uint8_t[]>&& buffer, size_t size)
+    : buffer(std::move(buffer)), size(size)
+    {
+        data = this->buffer.get();
+    }
+
+    virtual size_t read(void* ptr, size_t amount) override
+    {
+        amount = std::min(amount, size - position);
+        memcpy(ptr, data + position, amount);
+        position += amount;
+        return amount;
+    }
+    virtual size_t seek(size_t offset) override
+    {
+        position = std::min(offset, size);
+        return position;
+    }
+    virtual size_t tell() override
+    {
+        return position;
+    }
+    virtual size_t getSize() override
+    {
+        return size;
+    }
+};
+
+PackResourceProvider::PackResourceProvider(string filename)
+{
+    using namespace sp::resourcepack;
+
+    auto map = std::make_shared<sp::io::MappedFile>();
+    if (!map->open(filename))
+    {
+        LOG(ERROR, "Failed to open resource pack: ", filename);
+        return;
+    }
+    if (map->size() < sizeof(Header))
+    {
+        LOG(ERROR, "Resource pack too small: ", filename);
+        return;
+    }
+    const Header* header = reinterpret_cast<const Header*>(map->data());
+    if (memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version)
+    {
+        LOG(ERROR, "Not a resource pack, or unsupported version: ", filename);
+        return;
+    }
+    uint64_t table_end = sizeof(Header) + uint64_t(header->entry_count) * sizeof(Entry);
+    if (table_end + header->names_size > map->size())
+    {
+        LOG(ERROR, "Resource pack truncated: ", filename);
+        return;
+    }
+    const Entry* table = reinterpret_cast<const Entry*>(map->data() + sizeof(Header));
+    for(uint32_t n=0; n<header->entry_count; n++)
+    {
+        const Entry& e = table[n];
+        //Uncompressed entries are used straight from the mapping, so their size has to be the stored size.
+        //  The size of compressed entries is checked against the zstd frame when they are opened.
+        if (e.offset > map->size() || e.stored_size > map->size() - e.offset || uint64_t(e.name_offset) + e.name_length > header->names_size
+            || (!(e.flags & FlagZstd) && e.size != e.stored_size)
+            || (n > 0 && table[n - 1].name_hash > e.name_hash))
+        {
+            LOG(ERROR, "Resource pack has a corrupt table of contents: ", filename);
+            return;
+        }
+    }
+
+    entries = table;
+    entry_count = header->entry_count;
+    names = reinterpret_cast<const char*>(map->data() + table_end);
+    mapping = map;
+    LOG(INFO, "Opened resource pack ", filename, " with ", entry_count, " entries");
+}
+
+P<ResourceStream> PackResourceProvider::getResourceStream(string filename)
+{
+    using namespace sp::resourcepack;
+    if (!mapping)
+        return nullptr;
+
+    auto hash = hashName(filename);
+    auto it = std::lower_bound(entries, entries + entry_count, hash, [](const Entry& e, uint64_t h) { return e.name_hash < h; });
+    for(; it != entries + entry_count && it->name_hash == hash; ++it)
+    {
+        if (it->name_length != filename.size() || memcmp(names + it->name_offset, filename.data(), filename.size()) != 0)
+            continue;
+        const uint8_t* data = mapping->data() + it->offset;
+        if (!(it->flags & FlagZstd))
+            return new MemoryResourceStream(mapping, data, it->stored_size);
+
+        //Only allocate what the frame itself says it decompresses to, a damaged table of contents cannot ask for more.
+        if (ZSTD_getFrameContentSize(data, it->stored_size) != it->size)
+        {
+            LOG(ERROR, "Resource pack entry ", filename, " does not match its compressed data");
+            return nullptr;
+        }
+        std::unique_ptr<uint8_t[]> buffer(new uint8_t[it->size]);
+        auto result = ZSTD_decompress(buffer.get(), it->size, data, it->stored_size);
+        if (ZSTD_isError(result) || result != it->size)
+        {
+            LOG(ERROR, "Failed to decompress ", filename, " from resource pack");
+            return nullptr;
+        }
+        return new MemoryResourceStream(std::move(buffer), it->size);
+    }
+    return nullptr;
+}
+
+std::vector<string> PackResourceProvider::findResources(string searchPattern)
+{
+    std::vector<string> found_files;
+    for(uint32_t n=0; n<entry_count; n++)
+    {
+        string name(names + entries[n].name_offset, entries[n].name_length);
+        if (searchMatch(name, searchPattern))
+            found_files.push_back(name);
+    }
+    return found_files;
+}
+
 P<ResourceStream> getResourceStream(string filename)
 {
     foreach(ResourceProvider, rp, resourceProviders)
@@ -3,6 +3,10 @@
 
 #include "stringImproved.h"
 #include "P.h"
+#include <memory>
+
+namespace sp::resourcepack { struct Entry; }
+namespace sp::io { class MappedFile; }
 
 
 class ResourceStream : public virtual PObject
@@ -40,6 +44,27 @@ public:
     virtual std::vector<string> findResources(const string searchPattern) override;
 };
 
+/**
+    Serves resources from a single pack file, created with the sp_pack tool.
+    The file is memory mapped and the table of contents is sorted on name hash, so finding a resource does not touch the filesystem,
+    and streams of uncompressed entries read directly from the mapped memory.
+ */
+class PackResourceProvider : public ResourceProvider
+{
+public:
+    PackResourceProvider(const string filename);
+
+    bool isOpen() const { return mapping != nullptr; }
+
+    virtual P<ResourceStream> getResourceStream(const string filename) override;
+    virtual std::vector<string> findResources(const string searchPattern) override;
+private:
+    std::shared_ptr<sp::io::MappedFile> mapping;
+    const sp::resourcepack::Entry* entries = nullptr;
+    uint32_t entry_count = 0;
+    const char* names = nullptr;
+};
+
 P<ResourceStream> getResourceStream(const string filename);
 std::vector<string> findResources(const string searchPattern);
 
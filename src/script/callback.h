@@ -21,6 +21,7 @@ public:
     explicit operator bool();
 
     template<typename RET, typename... ARGS> Result<RET> call(ARGS... args) {
+        SP_PROFILE_ZONE("callback", "lua");
         //Get this callback from the registry
         lua_rawgetp(Environment::L, LUA_REGISTRYINDEX, this);
         if (!lua_isfunction(Environment::L, -1)) {
@@ -28,8 +29,10 @@ public:
             return Result<RET>::makeError("Callback not set.");
         }
         //If it exists, push the arguments with it, can run it.
+        auto budget = detail::Budget::fromFunction(Environment::L, -1);
         int arg_count = (Convert<ARGS>::toLua(Environment::L, args) + ... + 0);
         int ret_count = std::is_void_v<RET> ? 0 : 1;
+        detail::BudgetScope budget_scope(Environment::L, budget);
         int result = lua_pcall(Environment::L, arg_count, ret_count, 0);
         if (result) {
             auto ret = Result<RET>::makeError(lua_tostring(Environment::L, -1));
@@ -52,6 +55,7 @@ public:
      */
     template<typename... ARGS> Result<CoroutinePtr> callCoroutine(ARGS... args)
     {
+        SP_PROFILE_ZONE("callback", "lua");
         //Get this callback from the registry
         lua_rawgetp(Environment::L, LUA_REGISTRYINDEX, this);
         if (!lua_isfunction(Environment::L, -1)) {
@@ -59,6 +63,7 @@ public:
             return Result<CoroutinePtr>::makeError("Callback not set.");
         }
 
+        auto budget = detail::Budget::fromFunction(Environment::L, -1);
         lua_State* lua = lua_newthread(Environment::L);
         lua_rotate(Environment::L, -2, 1);
         lua_xmove(Environment::L, lua, 1);
@@ -66,9 +71,16 @@ public:
         //If it exists, push the arguments with it, can run it.
         int arg_count = (Convert<ARGS>::toLua(lua, args) + ... + 0);
         int nresults = 0;
-        int result = lua_resume(lua, nullptr, arg_count, &nresults);
-        if (result == LUA_YIELD)
-            return std::make_shared<Coroutine>(lua);
+        int result;
+        {
+            detail::BudgetScope budget_scope(lua, budget);
+            result = lua_resume(lua, nullptr, arg_count, &nresults);
+        }
+        if (result == LUA_YIELD) {
+            auto coroutine = std::make_shared<Coroutine>(lua, budget);
+            coroutine->yielded = nresults;
+            return coroutine;
+        }
         if (result) {
             auto ret = Result<CoroutinePtr>::makeError(lua_tostring(lua, -1));
             lua_pop(lua, 1);
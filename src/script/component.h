@@ -5,6 +5,9 @@
 #include "environment.h"
 #include "string.h"
 #include "ecs/query.h"
+#include "ecs/commandBuffer.h"
+#include <new>
+#include <type_traits>
 #include <unordered_map>
 
 
@@ -18,10 +21,24 @@ public:
     FuncPtr setter;
     using QueryFuncPtr = int(*)(lua_State*);
     QueryFuncPtr query;
+    // Push an iterator function for a generic for loop over all entities with this component and the components of the filters.
+    //  The iterator walks the component storage directly, it does not allocate per entity.
+    using IterateFuncPtr = int(*)(lua_State*, const ComponentRegistry* const* filters, int filter_count);
+    IterateFuncPtr iterate;
+    using HasFuncPtr = bool(*)(sp::ecs::Entity);
+    HasFuncPtr has;
+    // Record the value on top of the stack in the buffer: nil removes the component, a table replaces it.
+    //  Only converts the value, so it can run on any lua state, also on worker threads.
+    using RecordFuncPtr = void(*)(lua_State*, sp::ecs::CommandBuffer&, sp::ecs::Entity);
+    RecordFuncPtr record;
 
     static std::unordered_map<std::string, ComponentRegistry> components;
 };
 
+// Lua function for `for entity in queryEntities("component", ...) do`, which iterates all entities that have all the named components.
+//  Available as the global queryEntities in every environment that is not isolated.
+int luaQueryEntities(lua_State* L);
+
 namespace detail {
     struct MemberData {
         using GetterPtr = int(*)(lua_State*, const void*);
@@ -37,6 +54,100 @@ namespace detail {
         GetterPtr getter;
         SetterPtr setter;
     };
+
+    // Members are mirrored in a lua table, so they can be found by the lua key without converting it to a std::string.
+    //  Lua interns short strings, so finding a member is a pointer compare. The table is passed as upvalue to the metamethods,
+    //  and is stored in the registry keyed on the map address for the other functions.
+    template<typename MAP> void pushMemberTable(lua_State* L, MAP& map) {
+        if (lua_rawgetp(L, LUA_REGISTRYINDEX, &map) == LUA_TTABLE)
+            return;
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &map);
+    }
+
+    // Members can be added after the table is created, refresh the member table at table_index when the map grew.
+    template<typename MAP> void updateMemberTable(lua_State* L, MAP& map, int table_index) {
+        table_index = lua_absindex(L, table_index);
+        lua_rawgeti(L, table_index, 1);
+        bool up_to_date = lua_tointeger(L, -1) == static_cast<lua_Integer>(map.size());
+        lua_pop(L, 1);
+        if (up_to_date)
+            return;
+        for(auto& it : map) {
+            lua_pushlstring(L, it.first.data(), it.first.size());
+            lua_pushlightuserdata(L, &it.second);
+            lua_rawset(L, table_index);
+        }
+        lua_pushinteger(L, static_cast<lua_Integer>(map.size()));
+        lua_rawseti(L, table_index, 1);
+    }
+
+    // Find a member by the lua value at key_index in the member table at table_index.
+    template<typename MAP> const typename MAP::mapped_type* findMember(lua_State* L, MAP& map, int table_index, int key_index, bool update=true) {
+        table_index = lua_absindex(L, table_index);
+        key_index = lua_absindex(L, key_index);
+        lua_pushvalue(L, key_index);
+        auto result = static_cast<const typename MAP::mapped_type*>(lua_rawget(L, table_index) == LUA_TLIGHTUSERDATA ? lua_touserdata(L, -1) : nullptr);
+        lua_pop(L, 1);
+        if (result || !update)
+            return result;
+        updateMemberTable(L, map, table_index);
+        return findMember(L, map, table_index, key_index, false);
+    }
+
+    // Push a userdata proxy holding value, with the given metatable. Proxies are cached in a table with weak values under
+    //  cache in the registry, so scripts that access the same entity over and over reuse the proxy instead of creating garbage.
+    //  The proxy is only reused when it holds the same bytes, so a proxy of a destroyed entity keeps its old version.
+    template<typename T> void pushCachedProxy(lua_State* L, const void* cache, lua_Integer key, const T& value, const char* metatable) {
+        static_assert(std::has_unique_object_representations_v<T>, "Proxies are compared bytewise");
+        if (lua_rawgetp(L, LUA_REGISTRYINDEX, cache) != LUA_TTABLE) {
+            lua_pop(L, 1);
+            lua_newtable(L);
+            lua_newtable(L);
+            lua_pushstring(L, "v");
+            lua_setfield(L, -2, "__mode");
+            lua_setmetatable(L, -2);
+            lua_pushvalue(L, -1);
+            lua_rawsetp(L, LUA_REGISTRYINDEX, cache);
+        }
+        if (lua_rawgeti(L, -1, key) == LUA_TUSERDATA && memcmp(lua_touserdata(L, -1), &value, sizeof(T)) == 0) {
+            lua_remove(L, -2);
+            return;
+        }
+        lua_pop(L, 1);
+        *static_cast<T*>(lua_newuserdata(L, sizeof(T))) = value;
+        luaL_getmetatable(L, metatable);
+        lua_setmetatable(L, -2);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, -3, key);
+        lua_remove(L, -2);
+    }
+
+    // Step a pairs() iteration over the member table at table_index, from the member name at key_index, or nil to start.
+    //  Pushes the next name and returns its member, or returns nullptr and pushes nothing at the end.
+    template<typename MAP> const typename MAP::mapped_type* nextMember(lua_State* L, MAP&, int table_index, int key_index) {
+        table_index = lua_absindex(L, table_index);
+        lua_pushvalue(L, key_index);
+        while(lua_next(L, table_index)) {
+            if (lua_type(L, -2) == LUA_TSTRING) { // Skip the member count entry.
+                auto result = static_cast<const typename MAP::mapped_type*>(lua_touserdata(L, -1));
+                lua_pop(L, 1);
+                return result;
+            }
+            lua_pop(L, 1);
+        }
+        return nullptr;
+    }
+
+    template<typename MAP> const typename MAP::mapped_type* findMember(lua_State* L, MAP& map, int key_index) {
+        key_index = lua_absindex(L, key_index);
+        pushMemberTable(L, map);
+        auto result = findMember(L, map, -1, key_index);
+        lua_pop(L, 1);
+        return result;
+    }
 }
 
 template<typename T> class ComponentHandler
@@ -44,15 +155,20 @@ template<typename T> class ComponentHandler
 public:
     static void name(const char* name) {
         component_name = name;
-        ComponentRegistry::components[name] = {luaComponentGetter, luaComponentSetter, luaComponentQuery};
+        ComponentRegistry::components[name] = {luaComponentGetter, luaComponentSetter, luaComponentQuery, luaComponentIterate, luaComponentHas, luaComponentRecord};
 
         auto L = Environment::getLuaState();
         luaL_newmetatable(L, name);
-        lua_pushcfunction(L, luaIndex);
+        detail::pushMemberTable(L, members);
+        lua_pushcclosure(L, luaIndex, 1);
         lua_setfield(L, -2, "__index");
-        lua_pushcfunction(L, luaNewIndex);
+        detail::pushMemberTable(L, members);
+        detail::pushMemberTable(L, indexed_members);
+        lua_pushcclosure(L, luaNewIndex, 2);
         lua_setfield(L, -2, "__newindex");
-        lua_pushcfunction(L, luaPairs);
+        detail::pushMemberTable(L, members);
+        lua_pushcclosure(L, luaPairsNext, 1);
+        lua_pushcclosure(L, luaPairs, 1);
         lua_setfield(L, -2, "__pairs");
         lua_pushcfunction(L, [](lua_State* L) {
             if (!array_count_func) luaL_error(L, "Tried to get length of component %s that has no array", component_name);
@@ -68,57 +184,76 @@ public:
         
         array_metatable_name = name + string("_array");
         luaL_newmetatable(L, array_metatable_name.c_str());
-        lua_pushcfunction(L, [](lua_State* L) {
+        detail::pushMemberTable(L, indexed_members);
+        lua_pushcclosure(L, [](lua_State* L) {
             IndexedComponent* icptr = static_cast<IndexedComponent*>(lua_touserdata(L, -2));
             if (!icptr) return 0;
             if (!icptr->entity) return 0;
             auto ptr = icptr->entity.template getComponent<T>();
             if (!ptr) return 0;
             if (array_count_func(*ptr) <= icptr->index) return 0;
-            auto key = luaL_checkstring(L, -1);
-            auto it = indexed_members.find(key);
-            if (it == indexed_members.end()) return luaL_error(L, "Trying to get unknown component %s member %s", component_name, key);
-            return it->second.getter(L, ptr, icptr->index);
-        });
+            auto member = detail::findMember(L, indexed_members, lua_upvalueindex(1), -1);
+            if (!member) return luaL_error(L, "Trying to get unknown component %s member %s", component_name, luaL_checkstring(L, -1));
+            return member->getter(L, ptr, icptr->index);
+        }, 1);
         lua_setfield(L, -2, "__index");
-        lua_pushcfunction(L, [](lua_State* L) {
+        detail::pushMemberTable(L, indexed_members);
+        lua_pushcclosure(L, [](lua_State* L) {
             IndexedComponent* icptr = static_cast<IndexedComponent*>(lua_touserdata(L, -3));
             if (!icptr) return 0;
             if (!icptr->entity) return 0;
             auto ptr = icptr->entity.template getComponent<T>();
             if (!ptr) return 0;
             if (array_count_func(*ptr) <= icptr->index) return luaL_error(L, "Index out of range for assignment on component %s", component_name);
-            auto key = luaL_checkstring(L, -2);
-            auto it = indexed_members.find(key);
-            if (it == indexed_members.end()) return luaL_error(L, "Trying to set unknown component %s member %s", component_name, key);
-            it->second.setter(L, ptr, icptr->index);
+            auto member = detail::findMember(L, indexed_members, lua_upvalueindex(1), -2);
+            if (!member) return luaL_error(L, "Trying to set unknown component %s member %s", component_name, luaL_checkstring(L, -2));
+            member->setter(L, ptr, icptr->index);
             return 0;
-        });
+        }, 1);
         lua_setfield(L, -2, "__newindex");
-        lua_pushcfunction(L, [](lua_State* L) {
-            IndexedComponent* icptr = static_cast<IndexedComponent*>(lua_touserdata(L, -1));
+        detail::pushMemberTable(L, indexed_members);
+        lua_pushcclosure(L, [](lua_State* L) {
+            lua_settop(L, 2);
+            IndexedComponent* icptr = static_cast<IndexedComponent*>(luaL_checkudata(L, 1, array_metatable_name.c_str()));
+            if (!icptr->entity) return 0;
+            auto ptr = icptr->entity.template getComponent<T>();
+            if (!ptr) return 0;
+            if (array_count_func(*ptr) <= icptr->index) return luaL_error(L, "Index out of range for pairs on component %s", component_name);
+
+            if (lua_isnil(L, 2))
+                detail::updateMemberTable(L, indexed_members, lua_upvalueindex(1));
+            auto member = detail::nextMember(L, indexed_members, lua_upvalueindex(1), 2);
+            if (!member) return 0;
+            return 1 + member->getter(L, ptr, icptr->index);
+        }, 1);
+        lua_pushcclosure(L, [](lua_State* L) {
+            IndexedComponent* icptr = static_cast<IndexedComponent*>(lua_touserdata(L, 1));
             if (!icptr) return 0;
             if (!icptr->entity) return 0;
             auto ptr = icptr->entity.template getComponent<T>();
             if (!ptr) return 0;
             if (array_count_func(*ptr) <= icptr->index) return luaL_error(L, "Index out of range for pairs on component %s", component_name);
 
-            lua_newtable(L);
-            int tbl = lua_gettop(L);
-            for (auto mem : indexed_members) {
-                mem.second.getter(L, ptr, icptr->index);
-                lua_setfield(L, tbl, mem.first.c_str());
-            }
-            lua_settop(L, tbl);
-            lua_getglobal(L, "next");
-            lua_rotate(L, 2, -1);
+            lua_pushvalue(L, lua_upvalueindex(1));
+            lua_pushvalue(L, 1);
             lua_pushnil(L);
-            return 3; // next, tbl, nil
-        });
+            return 3; // next, self, nil
+        }, 1);
         lua_setfield(L, -2, "__pairs");
         lua_pushstring(L, "sandboxed");
         lua_setfield(L, -2, "__metatable");
         lua_pop(L, 1);
+
+        iterator_metatable_name = name + string("_iterator");
+        luaL_newmetatable(L, iterator_metatable_name.c_str());
+        lua_pushcfunction(L, [](lua_State* L) {
+            static_cast<LuaIterator*>(lua_touserdata(L, 1))->unpin();
+            return 0;
+        });
+        lua_setfield(L, -2, "__gc");
+        lua_pushstring(L, "sandboxed");
+        lua_setfield(L, -2, "__metatable");
+        lua_pop(L, 1);
     }
 
     static inline std::unordered_map<std::string, detail::MemberData> members;
@@ -140,17 +275,12 @@ private:
             int index = lua_tointeger(L, -1);
             if (index < 1 || index > array_count_func(*ptr))
                 return 0;
-            auto ic = static_cast<IndexedComponent*>(lua_newuserdata(L, sizeof(IndexedComponent)));
-            ic->entity = e;
-            ic->index = index - 1;
-            luaL_getmetatable(L, array_metatable_name.c_str());
-            lua_setmetatable(L, -2);
+            pushIndexedComponent(L, e, index - 1);
             return 1;
         }
-        auto key = luaL_checkstring(L, -1);
-        auto it = members.find(key);
-        if (it == members.end()) return luaL_error(L, "Trying to get unknown component %s member %s", component_name, key);
-        return it->second.getter(L, ptr);
+        auto member = detail::findMember(L, members, lua_upvalueindex(1), -1);
+        if (!member) return luaL_error(L, "Trying to get unknown component %s member %s", component_name, luaL_checkstring(L, -1));
+        return member->getter(L, ptr);
     }
 
     static int luaNewIndex(lua_State* L) {
@@ -168,10 +298,9 @@ private:
                     array_resize_func(*ptr, index);
                 lua_pushnil(L);
                 while(lua_next(L, -2)) {
-                    auto key = luaL_checkstring(L, -2);
-                    auto it = indexed_members.find(key);
-                    if (it == indexed_members.end()) return luaL_error(L, "Trying to set unknown component %s member %s", component_name, key);
-                    it->second.setter(L, ptr, index - 1);
+                    auto member = detail::findMember(L, indexed_members, lua_upvalueindex(2), -2);
+                    if (!member) return luaL_error(L, "Trying to set unknown component %s member %s", component_name, luaL_checkstring(L, -2));
+                    member->setter(L, ptr, index - 1);
                     lua_pop(L, 1);
                 }
             } else {
@@ -179,44 +308,44 @@ private:
             }
             return 0;
         }
-        auto key = luaL_checkstring(L, -2);
-        auto it = members.find(key);
-        if (it == members.end()) return luaL_error(L, "Trying to set unknown component %s member %s", component_name, key);
-        it->second.setter(L, ptr);
+        auto member = detail::findMember(L, members, lua_upvalueindex(1), -2);
+        if (!member) return luaL_error(L, "Trying to set unknown component %s member %s", component_name, luaL_checkstring(L, -2));
+        member->setter(L, ptr);
         return 0;
     }
 
+    // pairs() does not build a table with all values, the next function steps over the array entries first, and then the members.
     static int luaPairs(lua_State* L) {
-        auto eptr = lua_touserdata(L, -1);
-        if (!eptr) return 0;
-        auto e = *static_cast<ecs::Entity*>(eptr);
+        if (!luaToComponent(L, 1)) return 0;
+        lua_pushvalue(L, lua_upvalueindex(1));
+        lua_pushvalue(L, 1);
+        lua_pushnil(L);
+        return 3; // next, self, nil
+    }
+
+    static int luaPairsNext(lua_State* L) {
+        lua_settop(L, 2);
+        // The next function is reachable from scripts, so it can be called with anything.
+        auto e = *static_cast<ecs::Entity*>(luaL_checkudata(L, 1, component_name));
         if (!e) return 0;
         auto ptr = e.getComponent<T>();
         if (!ptr) return 0;
 
-        lua_newtable(L);
-        int tbl = lua_gettop(L);
-        if (array_count_func) {
-            int count = array_count_func(*ptr);
-            for (int i = 0; i < count; i++) {
-                auto ic = static_cast<IndexedComponent*>(lua_newuserdata(L, sizeof(IndexedComponent)));
-                ic->entity = e;
-                ic->index = i;
-                luaL_getmetatable(L, array_metatable_name.c_str());
-                lua_setmetatable(L, -2);
-                lua_seti(L, tbl, i + 1);
+        if (lua_isnil(L, 2) || lua_isinteger(L, 2)) {
+            int index = lua_isnil(L, 2) ? 0 : lua_tointeger(L, 2);
+            if (array_count_func && index < array_count_func(*ptr)) {
+                lua_pushinteger(L, index + 1);
+                pushIndexedComponent(L, e, index);
+                return 2;
             }
+            // Done with the array, continue with the members from the start.
+            lua_pushnil(L);
+            lua_replace(L, 2);
+            detail::updateMemberTable(L, members, lua_upvalueindex(1));
         }
-        for (auto mem : members) {
-            mem.second.getter(L, ptr);
-            lua_setfield(L, tbl, mem.first.c_str());
-        }
-
-        lua_settop(L, tbl);
-        lua_getglobal(L, "next");
-        lua_rotate(L, 2, -1);
-        lua_pushnil(L);
-        return 3; // next, tbl, nil
+        auto member = detail::nextMember(L, members, lua_upvalueindex(1), 2);
+        if (!member) return 0;
+        return 1 + member->getter(L, ptr);
     }
 
     static T* luaToComponent(lua_State* L, int index) {
@@ -229,47 +358,78 @@ private:
 
     static int luaComponentGetter(lua_State* L, sp::ecs::Entity e, const char* key) {
         if (!e.hasComponent<T>()) return 0;
-        *static_cast<ecs::Entity*>(lua_newuserdata(L, sizeof(ecs::Entity))) = e;
-        luaL_getmetatable(L, key);
-        lua_setmetatable(L, -2);
+        detail::pushCachedProxy(L, &component_name, e.getIndex(), e, key);
         return 1;
     }
 
+    static void pushIndexedComponent(lua_State* L, sp::ecs::Entity e, int index) {
+        IndexedComponent ic{e, index};
+        detail::pushCachedProxy(L, &array_metatable_name, (static_cast<lua_Integer>(e.getIndex()) << 32) | index, ic, array_metatable_name.c_str());
+    }
+
     static int luaComponentSetter(lua_State* L, sp::ecs::Entity e, const char* key) {
         if (lua_isnil(L, -1)) {
             e.removeComponent<T>();
         } else if (lua_istable(L, -1)) {
-            auto& component = e.getOrAddComponent<T>();
-            lua_pushnil(L);
-            while(lua_next(L, -2)) {
-                if (array_count_func && lua_isinteger(L, -2)) {
-                    int index = lua_tointeger(L, -2) - 1;
-                    if (index < 0) luaL_error(L, "Cannot assign indexes below 1 on component %s", component_name);
-                    if (array_count_func(component) < index + 1)
-                        array_resize_func(component, index + 1);
-                    luaL_checktype(L, -1, LUA_TTABLE);
-                    lua_pushnil(L);
-                    while(lua_next(L, -2)) {
-                        auto key = luaL_checkstring(L, -2);
-                        auto it = indexed_members.find(key);
-                        if (it == indexed_members.end()) return luaL_error(L, "Trying to set unknown component %s member %s", component_name, key);
-                        it->second.setter(L, &component, index);
-                        lua_pop(L, 1);
-                    }
-                } else {
-                    auto key = luaL_checkstring(L, -2);
-                    auto it = members.find(key);
-                    if (it == members.end()) return luaL_error(L, "Trying to set unknown component %s member %s", component_name, key);
-                    it->second.setter(L, &component);
-                }
-                lua_pop(L, 1);
-            }
+            luaSetMembers(L, e.getOrAddComponent<T>());
         } else {
             return luaL_error(L, "Bad assignment to component %s member %s, nil or table expected.", component_name, key);
         }
         return 0;
     }
 
+    // Assign the members and array entries of the table on top of the stack to the component.
+    static void luaSetMembers(lua_State* L, T& component) {
+        lua_pushnil(L);
+        while(lua_next(L, -2)) {
+            if (array_count_func && lua_isinteger(L, -2)) {
+                int index = lua_tointeger(L, -2) - 1;
+                if (index < 0) luaL_error(L, "Cannot assign indexes below 1 on component %s", component_name);
+                if (array_count_func(component) < index + 1)
+                    array_resize_func(component, index + 1);
+                luaL_checktype(L, -1, LUA_TTABLE);
+                lua_pushnil(L);
+                while(lua_next(L, -2)) {
+                    auto member = detail::findMember(L, indexed_members, -2);
+                    if (!member) luaL_error(L, "Trying to set unknown component %s member %s", component_name, luaL_checkstring(L, -2));
+                    member->setter(L, &component, index);
+                    lua_pop(L, 1);
+                }
+            } else {
+                auto member = detail::findMember(L, members, -2);
+                if (!member) luaL_error(L, "Trying to set unknown component %s member %s", component_name, luaL_checkstring(L, -2));
+                member->setter(L, &component);
+            }
+            lua_pop(L, 1);
+        }
+    }
+
+    static void luaComponentRecord(lua_State* L, sp::ecs::CommandBuffer& buffer, sp::ecs::Entity e) {
+        if (lua_isnil(L, -1)) {
+            buffer.removeComponent<T>(e);
+            return;
+        }
+        if (!lua_istable(L, -1))
+            luaL_error(L, "Bad value for component %s, nil or table expected.", component_name);
+        // Lua errors skip C++ destructors, so the members are set in a protected call, and the error is raised again
+        //  once the component is gone.
+        int status;
+        {
+            T component{};
+            lua_pushcfunction(L, [](lua_State* L) -> int {
+                luaSetMembers(L, *static_cast<T*>(lua_touserdata(L, 1)));
+                return 0;
+            });
+            lua_pushlightuserdata(L, &component);
+            lua_pushvalue(L, -3);
+            status = lua_pcall(L, 2, 0, 0);
+            if (status == LUA_OK)
+                buffer.addComponent<T>(e, std::move(component));
+        }
+        if (status != LUA_OK)
+            lua_error(L);
+    }
+
     static int luaComponentQuery(lua_State* L)
     {
         lua_newtable(L);
@@ -282,8 +442,60 @@ private:
         return 1;
     }
 
+    static bool luaComponentHas(sp::ecs::Entity e) {
+        return e.hasComponent<T>();
+    }
+
+    // The query iterator is kept in a userdata, the filters of the other components as upvalues of the next function.
+    //  Entities are pushed as light userdata, so stepping does not allocate. Like the C++ Query, entities that are destroyed
+    //  or lose a component during the loop are skipped.
+    //  The loop can span frames (a coroutine that waits or is preempted inside it), so it keeps the component storages from being
+    //  compacted, which would move the position it iterates at. That ends when the loop finishes, or when a loop that was broken off is collected.
+    struct LuaIterator {
+        typename sp::ecs::Query<T>::Iterator it;
+        bool pinned;
+
+        void unpin() {
+            if (pinned)
+                sp::ecs::ComponentStorageBase::unpinCompaction();
+            pinned = false;
+        }
+    };
+    static_assert(std::is_trivially_destructible_v<LuaIterator>);
+
+    static int luaComponentIterate(lua_State* L, const ComponentRegistry* const* filters, int filter_count)
+    {
+        new (lua_newuserdata(L, sizeof(LuaIterator))) LuaIterator{sp::ecs::Query<T>().begin(), true};
+        sp::ecs::ComponentStorageBase::pinCompaction();
+        luaL_getmetatable(L, iterator_metatable_name.c_str());
+        lua_setmetatable(L, -2);
+        for(int n=0; n<filter_count; n++)
+            lua_pushlightuserdata(L, const_cast<ComponentRegistry*>(filters[n]));
+        lua_pushcclosure(L, luaIterateNext, filter_count + 1);
+        return 1;
+    }
+
+    static int luaIterateNext(lua_State* L)
+    {
+        auto state = static_cast<LuaIterator*>(lua_touserdata(L, lua_upvalueindex(1)));
+        auto it = &state->it;
+        it->refresh();
+        while(!it->atEnd()) {
+            auto e = std::get<0>(**it);
+            ++(*it);
+            bool match = true;
+            for(int n=2; match && lua_type(L, lua_upvalueindex(n)) == LUA_TLIGHTUSERDATA; n++)
+                match = static_cast<const ComponentRegistry*>(lua_touserdata(L, lua_upvalueindex(n)))->has(e);
+            if (match)
+                return Convert<sp::ecs::Entity>::toLua(L, e);
+        }
+        state->unpin();
+        return 0;
+    }
+
     static inline const char* component_name;
     static inline string array_metatable_name;
+    static inline string iterator_metatable_name;
     struct IndexedComponent {
         sp::ecs::Entity entity;
         int index;
@@ -3,8 +3,8 @@
 
 namespace sp::script {
 
-Coroutine::Coroutine(lua_State* lua)
-: lua(lua)
+Coroutine::Coroutine(lua_State* lua, detail::Budget* budget)
+: lua(lua), budget(budget)
 {
     lua_rawsetp(Environment::L, LUA_REGISTRYINDEX, this);
 }
@@ -4,6 +4,8 @@
 #include <nonCopyable.h>
 #include <result.h>
 #include <script/conversion.h>
+#include <script/environment.h>
+#include <profiler.h>
 #include <lua/lua.hpp>
 
 namespace sp::script {
@@ -11,7 +13,7 @@ namespace sp::script {
 class Coroutine : NonCopyable
 {
 public:
-    Coroutine(lua_State*);
+    Coroutine(lua_State*, detail::Budget* budget=nullptr);
     ~Coroutine();
 
     /** Resume the coroutine.
@@ -21,19 +23,27 @@ public:
      */
     template<typename... ARGS> Result<bool> resume(ARGS... args)
     {
+        SP_PROFILE_ZONE("coroutine", "lua");
         if (!lua)
             return false;
 
+        //The values given to yield are the results of the previous resume, remove them before resuming.
+        lua_pop(lua, yielded);
+        yielded = 0;
         int arg_count = (Convert<ARGS>::toLua(lua, args) + ... + 0);
         int nresult = 0;
+        detail::BudgetScope budget_scope(lua, budget);
         int result = lua_resume(lua, nullptr, arg_count, &nresult);
         if (result == LUA_YIELD) {
+            yielded = nresult;
             return true;
         }
         if (result != LUA_OK)
         {
             auto res = Result<bool>::makeError(lua_tostring(lua, -1));
             lua_pop(lua, 1);
+            release();
+            return res;
         }
         release();
         return false;
@@ -43,6 +53,11 @@ private:
     void release();
 
     lua_State* lua;
+    detail::Budget* budget;
+    int yielded = 0;
+
+    friend class Callback;
+    friend class Scheduler;
 };
 
 typedef std::shared_ptr<Coroutine> CoroutinePtr;
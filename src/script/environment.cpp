@@ -1,6 +1,16 @@
 #include "script/environment.h"
 #include "script/component.h"
+#include "logging.h"
+#include "threadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
 #include <string.h>
+#include <thread>
 
 
 namespace sp::script {
@@ -32,35 +42,239 @@ public:
 
 
 lua_State* Environment::L = nullptr;
+thread_local detail::Budget* detail::Budget::current = nullptr;
+std::atomic<uint64_t> detail::Budget::current_frame{0};
+
+static bool gc_driven_by_frames = false;
+static bool gc_cycle_running = false;
+static int gc_base_kb = 0;
+// A collection cycle starts once the heap grew to this many times its size after the previous cycle.
+static constexpr int gc_pause = 2;
+
+namespace {
+string bytecode_cache_directory;
+
+// Increase when the cache file layout changes, so old cache files are ignored.
+constexpr uint32_t bytecode_cache_version = 2;
+
+struct BytecodeCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t lua_version;
+    uint32_t reserved;
+    uint64_t source_hash;
+    uint64_t source_size;
+    uint64_t data_size;
+    uint64_t data_hash;
+};
+
+constexpr uint64_t fnv1a_basis = 0xcbf29ce484222325ULL;
+
+uint64_t fnv1a(uint64_t hash, std::string_view data)
+{
+    for(auto c : data) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// FNV-1a over the chunk name and the source, the bytecode contains the chunk name for error messages.
+uint64_t sourceHash(const string& code, const string& name)
+{
+    return fnv1a(fnv1a(fnv1a_basis, name), code);
+}
+
+int bytecodeWriter(lua_State* /*L*/, const void* data, size_t size, void* userdata)
+{
+    static_cast<std::string*>(userdata)->append(static_cast<const char*>(data), size);
+    return 0;
+}
+
+// Every block starts with a header that records the budget it is charged to, so the block is credited to the same budget
+//  when it is freed, no matter which script runs at that moment.
+struct alignas(std::max_align_t) AllocHeader {
+    detail::Budget* budget;
+};
+}
+
+static void* luaAlloc(void* /*ud*/, void* ptr, size_t osize, size_t nsize)
+{
+    auto header = ptr ? static_cast<AllocHeader*>(ptr) - 1 : nullptr;
+    auto budget = header ? header->budget : detail::Budget::current;
+    if (nsize == 0) {
+        if (header) {
+            if (budget) {
+                budget->memory_used -= osize;
+                if (budget->orphaned && budget->memory_used == 0)
+                    delete budget;
+            }
+            free(header);
+        }
+        return nullptr;
+    }
+    if (!header)
+        osize = 0;  // For new blocks osize is the type of object, not a size.
+    // Returning null makes lua run an emergency collection, and raise a memory error if that does not free enough.
+    if (budget && budget->memory_limit && nsize > osize && budget->memory_used + nsize - osize > budget->memory_limit)
+        return nullptr;
+    auto result = static_cast<AllocHeader*>(realloc(header, sizeof(AllocHeader) + nsize));
+    if (!result)
+        return nullptr;
+    result->budget = budget;
+    if (budget)
+        budget->memory_used = budget->memory_used + nsize - osize;
+    return result + 1;
+}
+
+// Runs every hook_interval instructions, so the budget check itself costs next to nothing.
+void detail::Budget::instructionHook(lua_State* L, lua_Debug* /*ar*/)
+{
+    auto budget = detail::Budget::current;
+    if (!budget || !budget->instruction_limit)
+        return;
+    auto frame = detail::Budget::current_frame.load();
+    if (budget->frame != frame) {
+        budget->frame = frame;
+        budget->instructions = 0;
+    }
+    budget->instructions += hook_interval;
+    if (budget->instructions <= budget->instruction_limit)
+        return;
+    if (lua_isyieldable(L)) {
+        lua_yield(L, 0);  // Pause the coroutine, resuming it continues where it left off.
+        return;
+    }
+    luaL_error(L, "Script exceeded its instruction budget of %d per frame", static_cast<int>(budget->instruction_limit));
+}
+
+static int luaPanic(lua_State* L)
+{
+    LOG(Error, "Unprotected error in lua: ", lua_isstring(L, -1) ? lua_tostring(L, -1) : "?");
+    Logging::flush();
+    return 0;   // Returning from the panic function aborts.
+}
+
+detail::Budget* detail::Budget::fromFunction(lua_State* L, int index)
+{
+    if (!lua_isfunction(L, index) || lua_iscfunction(L, index))
+        return nullptr;
+    index = lua_absindex(L, index);
+    for(int n=1; auto name = lua_getupvalue(L, index, n); n++) {
+        if (strcmp(name, "_ENV") == 0) {
+            lua_getfield(L, LUA_REGISTRYINDEX, "ENVBUDGET");
+            lua_rotate(L, -2, 1);
+            lua_rawget(L, -2);
+            auto result = static_cast<Budget*>(lua_touserdata(L, -1));
+            lua_pop(L, 2);
+            return result;
+        }
+        lua_pop(L, 1);
+    }
+    return nullptr;
+}
+
+struct Environment::Isolation
+{
+    std::mutex mutex;
+    std::vector<Message> inbox;
+    std::vector<Message> outbox;
+};
+
+namespace {
+std::mutex isolated_environments_mutex;
+std::vector<Environment*> isolated_environments;
+// Component changes requested by isolated scripts, applied after all of them ran.
+ecs::CommandBuffer isolated_commands;
+}
 
 Environment::Environment(Environment* parent)
 {
-    getLuaState();
-    lua_newtable(L);
-    lua_pushvalue(L, -1);
-    lua_setfield(L, -2, "_G");
+    lua = getLuaState();
+    budget = new detail::Budget();
+    // The environment table is charged to the budget itself, so the budget lives as long as functions can refer to it.
+    detail::BudgetScope budget_scope(lua, budget);
+    createEnvironmentTable(parent);
+    if (!parent) {
+        // Child environments find it through their parent.
+        lua_rawgetp(lua, LUA_REGISTRYINDEX, this);
+        lua_pushcfunction(lua, luaQueryEntities);
+        lua_setfield(lua, -2, "queryEntities");
+        lua_pop(lua, 1);
+    }
+}
+
+Environment::Environment(Isolated)
+{
+    lua = newLuaState();
+    isolation = std::make_unique<Isolation>();
+    budget = new detail::Budget();
+    detail::BudgetScope budget_scope(lua, budget);
+    createEnvironmentTable(nullptr);
+
+    lua_rawgetp(lua, LUA_REGISTRYINDEX, this);
+    lua_pushlightuserdata(lua, this);
+    lua_pushcclosure(lua, [](lua_State* L) -> int {
+        auto env = static_cast<Environment*>(lua_touserdata(L, lua_upvalueindex(1)));
+        auto message = Message::fromLua(L, 1);
+        std::lock_guard<std::mutex> lock(env->isolation->mutex);
+        env->isolation->outbox.push_back(std::move(message));
+        return 0;
+    }, 1);
+    lua_setfield(lua, -2, "send");
+    lua_pushcfunction(lua, [](lua_State* L) -> int {
+        auto entity = Convert<ecs::Entity>::fromLua(L, 1);
+        auto name = luaL_checkstring(L, 2);
+        // The registry is only filled at startup, so reading it from a worker thread is safe.
+        auto it = ComponentRegistry::components.find(name);
+        if (it == ComponentRegistry::components.end())
+            return luaL_error(L, "Trying to set unknown component %s", name);
+        lua_settop(L, 3);
+        it->second.record(L, isolated_commands, entity);
+        return 0;
+    });
+    lua_setfield(lua, -2, "setComponent");
+    lua_pop(lua, 1);
+
+    std::lock_guard<std::mutex> lock(isolated_environments_mutex);
+    isolated_environments.push_back(this);
+}
+
+void Environment::createEnvironmentTable(Environment* parent)
+{
+    lua_newtable(lua);
+    lua_pushvalue(lua, -1);
+    lua_setfield(lua, -2, "_G");
 
     for(auto s : {
         "assert", "error", "getmetatable", "ipairs", "next", "pairs", "pcall", "rawequal", "rawlen", "rawget", "rawset", "select", "setmetatable", "tonumber", "tostring", "xpcall", "type", "_VERSION",
         "table", "string", "math"
     }) {
-        lua_getglobal(L, s);
-        lua_setfield(L, -2, s);
+        lua_getglobal(lua, s);
+        lua_setfield(lua, -2, s);
     }
 
-    lua_newtable(L);  /* meta table for the environment, with an __index pointing to the parent environment so we can access it's data. */
+    lua_newtable(lua);  /* meta table for the environment, with an __index pointing to the parent environment so we can access it's data. */
     if (parent) {
-        lua_pushstring(L, "__index");
-        lua_rawgetp(L, LUA_REGISTRYINDEX, parent);
-        lua_rawset(L, -3);
+        lua_pushstring(lua, "__index");
+        lua_rawgetp(lua, LUA_REGISTRYINDEX, parent);
+        lua_rawset(lua, -3);
     }
-    lua_pushstring(L, "sandbox");
-    lua_setfield(L, -2, "__metatable");
-    lua_setmetatable(L, -2);
+    lua_pushstring(lua, "sandbox");
+    lua_setfield(lua, -2, "__metatable");
+    lua_setmetatable(lua, -2);
+
+    lua_getfield(lua, LUA_REGISTRYINDEX, "ENVBUDGET");
+    lua_pushvalue(lua, -2);
+    lua_pushlightuserdata(lua, budget);
+    lua_rawset(lua, -3);
+    lua_pop(lua, 1);
 
-    lua_rawsetp(L, LUA_REGISTRYINDEX, this);
+    lua_rawsetp(lua, LUA_REGISTRYINDEX, this);
 }
 
+static char entity_components_cache;
+
 static int luaEntityIsValid(lua_State* L) {
     auto e = Convert<ecs::Entity>::fromLua(L, 1);
     lua_pushboolean(L, static_cast<bool>(e));
@@ -81,9 +295,7 @@ static int luaEntityIndex(lua_State* L) {
         return 1;
     }
     if (strcmp(key, "components") == 0) {
-        *static_cast<ecs::Entity*>(lua_newuserdata(L, sizeof(ecs::Entity))) = e;
-        luaL_getmetatable(L, "entity_components");
-        lua_setmetatable(L, -2);
+        detail::pushCachedProxy(L, &entity_components_cache, e.getIndex(), e, "entity_components");
         return 1;
     }
     if (key[0] != '_' && luaL_getmetafield(L, -2, key) != LUA_TNIL) {
@@ -147,9 +359,7 @@ static int luaEntityPairsNext(lua_State* L) {
         // nil => first call; return components first
         lua_pop(L, 1);
         lua_pushstring(L, "components");
-        *static_cast<ecs::Entity*>(lua_newuserdata(L, sizeof(ecs::Entity))) = e;
-        luaL_getmetatable(L, "entity_components");
-        lua_setmetatable(L, -2);
+        detail::pushCachedProxy(L, &entity_components_cache, e.getIndex(), e, "entity_components");
         return 2;
     }
     if (lua_type(L, 2) == LUA_TSTRING && !strcmp(lua_tostring(L, 2), "components")) {
@@ -185,9 +395,9 @@ static int luaEntityComponentsIndex(lua_State* L) {
     if (!e) return 0;
 
     auto key = luaL_checkstring(L, -1);
-    auto it = ComponentRegistry::components.find(key);
-    if (it != ComponentRegistry::components.end()) {
-        return it->second.getter(L, e, key);
+    auto component = detail::findMember(L, ComponentRegistry::components, -1);
+    if (component) {
+        return component->getter(L, e, key);
     }
     return luaL_error(L, "Tried to get non-existing component %s", key);
 }
@@ -199,34 +409,57 @@ static int luaEntityComponentsNewIndex(lua_State* L) {
     if (!e) return 0;
 
     auto key = luaL_checkstring(L, -2);
-    auto it = ComponentRegistry::components.find(key);
-    if (it != ComponentRegistry::components.end()) {
-        return it->second.setter(L, e, key);
+    auto component = detail::findMember(L, ComponentRegistry::components, -2);
+    if (component) {
+        return component->setter(L, e, key);
     }
     return luaL_error(L, "Tried to set non-existing component %s", key);
 }
 
+static int luaEntityComponentsPairsNext(lua_State* L) {
+    lua_settop(L, 2);
+    auto e = *static_cast<ecs::Entity*>(luaL_checkudata(L, 1, "entity_components"));
+    if (!e) return 0;
+
+    detail::pushMemberTable(L, ComponentRegistry::components);
+    if (lua_isnil(L, 2))
+        detail::updateMemberTable(L, ComponentRegistry::components, 3);
+    lua_pushvalue(L, 2);
+    // Step over the registered components, skipping the ones this entity does not have.
+    while(auto component = detail::nextMember(L, ComponentRegistry::components, 3, -1)) {
+        lua_replace(L, 4);
+        if (component->getter(L, e, lua_tostring(L, 4)) == 1)
+            return 2;
+    }
+    return 0;
+}
+
 static int luaEntityComponentsPairs(lua_State* L) {
-    auto eptr = lua_touserdata(L, -1);
+    auto eptr = lua_touserdata(L, 1);
     if (!eptr) return 0;
     auto e = *static_cast<ecs::Entity*>(eptr);
     if (!e) return 0;
 
-    lua_newtable(L);
-    int tbl = lua_gettop(L);
+    lua_pushcfunction(L, luaEntityComponentsPairsNext);
+    lua_pushvalue(L, 1);
+    lua_pushnil(L);
+    return 3; // next, components, nil
+}
 
-    for (auto entry : ComponentRegistry::components) {
-        int n = entry.second.getter(L, e, entry.first.c_str());
-        if (n == 1) {
-            lua_setfield(L, tbl, entry.first.c_str());
-        }
+int luaQueryEntities(lua_State* L) {
+    constexpr int max_components = 16;
+    int count = lua_gettop(L);
+    if (count < 1)
+        return luaL_error(L, "queryEntities requires at least one component name");
+    if (count > max_components)
+        return luaL_error(L, "queryEntities supports up to %d components", max_components);
+    const ComponentRegistry* filters[max_components];
+    for(int n=0; n<count; n++) {
+        filters[n] = detail::findMember(L, ComponentRegistry::components, n + 1);
+        if (!filters[n])
+            return luaL_error(L, "Tried to query non-existing component %s", luaL_checkstring(L, n + 1));
     }
-
-    lua_settop(L, tbl);
-    lua_getglobal(L, "next");
-    lua_rotate(L, 2, -1);
-    lua_pushnil(L);
-    return 3; // next, tbl, nil
+    return filters[0]->iterate(L, filters + 1, count - 1);
 }
 
 static int luaEntityEqual(lua_State* L) {
@@ -239,26 +472,41 @@ static int luaEntityEqual(lua_State* L) {
     return 1;
 }
 
+lua_State* Environment::newLuaState()
+{
+    auto L = lua_newstate(luaAlloc, nullptr);
+    lua_atpanic(L, luaPanic);
+
+    luaL_requiref(L, "_G", luaopen_base, 1);
+    lua_pop(L, 1);
+    luaL_requiref(L, LUA_TABLIBNAME, luaopen_table, 1);
+    lua_pop(L, 1);
+    luaL_requiref(L, LUA_STRLIBNAME, luaopen_string, 1);
+    lua_pop(L, 1);
+    luaL_requiref(L, LUA_MATHLIBNAME, luaopen_math, 1);
+    lua_pop(L, 1);
+
+    //Protect the string metatable
+    lua_pushliteral(L, "");
+    lua_getmetatable(L, -1);
+    lua_pushstring(L, "sandboxed");
+    lua_setfield(L, -2, "__metatable");
+    lua_pop(L, 2);
+
+    lua_newtable(L); // Environment table to budget, with weak keys so it does not keep the environments alive.
+    lua_newtable(L);
+    lua_pushstring(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, "ENVBUDGET");
+    return L;
+}
+
 lua_State* Environment::getLuaState()
 {
     if (!L) {
-        L = luaL_newstate();
-
-        luaL_requiref(L, "_G", luaopen_base, 1);
-        lua_pop(L, 1);
-        luaL_requiref(L, LUA_TABLIBNAME, luaopen_table, 1);
-        lua_pop(L, 1);
-        luaL_requiref(L, LUA_STRLIBNAME, luaopen_string, 1);
-        lua_pop(L, 1);
-        luaL_requiref(L, LUA_MATHLIBNAME, luaopen_math, 1);
-        lua_pop(L, 1);
+        L = newLuaState();
 
-        //Protect the string metatable
-        lua_pushliteral(L, "");
-        lua_getmetatable(L, -1);
-        lua_pushstring(L, "sandboxed");
-        lua_setfield(L, -2, "__metatable");
-        lua_pop(L, 2);
 
         lua_newtable(L);
         lua_setfield(L, LUA_REGISTRYINDEX, "EFT");//Entity function table.
@@ -296,22 +544,198 @@ lua_State* Environment::getLuaState()
     return L;
 }
 
+void Environment::setBytecodeCacheDirectory(const string& path)
+{
+    bytecode_cache_directory = path;
+}
+
+int Environment::load(lua_State* L, const string& code, const string& name, bool use_cache)
+{
+    if (!use_cache || bytecode_cache_directory.empty()) {
+        SP_PROFILE_ZONE("compile", "lua");
+        return luaL_loadbufferx(L, code.c_str(), code.length(), name.c_str(), "t");
+    }
+
+    BytecodeCacheHeader header{{'S', 'P', 'L', 'C'}, bytecode_cache_version, LUA_VERSION_RELEASE_NUM, 0, sourceHash(code, name), code.length(), 0, 0};
+    char filename[64];
+    snprintf(filename, sizeof(filename), "%016llx.luac", static_cast<unsigned long long>(header.source_hash));
+    auto path = std::filesystem::u8path(bytecode_cache_directory.c_str()) / filename;
+
+    std::ifstream input(path, std::ios::binary);
+    if (input) {
+        SP_PROFILE_ZONE("load_cached", "lua");
+        BytecodeCacheHeader cached_header;
+        std::error_code ec;
+        auto file_size = std::filesystem::file_size(path, ec);
+        if (!ec && input.read(reinterpret_cast<char*>(&cached_header), sizeof(cached_header))
+            && memcmp(cached_header.magic, header.magic, sizeof(header.magic)) == 0 && cached_header.version == header.version
+            && cached_header.lua_version == header.lua_version && cached_header.source_hash == header.source_hash
+            && cached_header.source_size == header.source_size && cached_header.data_size == file_size - sizeof(cached_header)) {
+            std::string bytecode(cached_header.data_size, '\0');
+            // Lua does not verify bytecode, a damaged file can crash the interpreter, so only load exactly what was written.
+            if (input.read(bytecode.data(), bytecode.size()) && fnv1a(fnv1a_basis, bytecode) == cached_header.data_hash) {
+                if (luaL_loadbufferx(L, bytecode.data(), bytecode.size(), name.c_str(), "b") == LUA_OK)
+                    return LUA_OK;
+                lua_pop(L, 1);
+            }
+        }
+        LOG(Warning, "[lua]: ignoring invalid bytecode cache file: ", path.u8string());
+    }
+
+    int result;
+    {
+        SP_PROFILE_ZONE("compile", "lua");
+        result = luaL_loadbufferx(L, code.c_str(), code.length(), name.c_str(), "t");
+    }
+    if (result != LUA_OK)
+        return result;
+
+    // Debug info is kept, it is needed for error messages and to find the environment of functions.
+    std::string bytecode;
+    lua_dump(L, bytecodeWriter, &bytecode, 0);
+    header.data_size = bytecode.size();
+    header.data_hash = fnv1a(fnv1a_basis, bytecode);
+
+    // Write to a temporary file first, so other threads or processes never see a partial file.
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    auto temp_path = path;
+    temp_path += "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+    {
+        std::ofstream output(temp_path, std::ios::binary | std::ios::trunc);
+        output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        output.write(bytecode.data(), bytecode.size());
+        if (!output)
+            ec = std::make_error_code(std::errc::io_error);
+    }
+    if (!ec)
+        std::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+        LOG(Warning, "[lua]: failed to write bytecode cache file: ", path.u8string());
+        std::filesystem::remove(temp_path, ec);
+    }
+    return LUA_OK;
+}
+
 Environment::~Environment()
 {
-    lua_pushnil(L);
-    lua_rawsetp(L, LUA_REGISTRYINDEX, this);
+    if (isolation) {
+        {
+            std::lock_guard<std::mutex> lock(isolated_environments_mutex);
+            isolated_environments.erase(std::find(isolated_environments.begin(), isolated_environments.end(), this));
+        }
+        lua_close(lua);
+    } else {
+        lua_pushnil(lua);
+        lua_rawsetp(lua, LUA_REGISTRYINDEX, this);
+    }
+    if (budget->memory_used == 0)
+        delete budget;
+    else
+        budget->orphaned = true;
+}
+
+void Environment::updateFrame(float gc_time)
+{
+    detail::Budget::current_frame++;
+    if (!L)
+        return;
+    SP_PROFILE_ZONE("gc", "lua");
+    if (!gc_driven_by_frames) {
+        gc_driven_by_frames = true;
+        lua_gc(L, LUA_GCINC, 0, 0, 0);
+        gc_base_kb = lua_gc(L, LUA_GCCOUNT);
+    }
+
+    if (!gc_cycle_running && lua_gc(L, LUA_GCCOUNT) >= gc_base_kb * gc_pause)
+        gc_cycle_running = true;
+    if (gc_cycle_running) {
+        // Step till the time is used up, or the cycle is done. When scripts allocate faster than the steps can keep up with,
+        //  and the heap doubled again since the cycle started, the cycle is finished regardless of the time.
+        auto start = std::chrono::steady_clock::now();
+        auto end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(gc_time));
+        do {
+            if (lua_gc(L, LUA_GCSTEP, 0)) {
+                gc_cycle_running = false;
+                gc_base_kb = lua_gc(L, LUA_GCCOUNT);
+                break;
+            }
+        } while(std::chrono::steady_clock::now() < end || lua_gc(L, LUA_GCCOUNT) > gc_base_kb * gc_pause * 2);
+    }
+
+    // Till the next frame the collector stays idle, unless the heap doubles before then, for example during a long runFile.
+    //  Lua then starts stepping it from its allocations, as it would without updateFrame.
+    lua_gc(L, LUA_GCRESTART);
+    lua_gc(L, LUA_GCSTEP, -std::max(lua_gc(L, LUA_GCCOUNT), 1));
 }
 
 bool Environment::isFunction(const string& function_name)
 {
     //Try to find our function in the environment table
-    lua_rawgetp(L, LUA_REGISTRYINDEX, this);
-    lua_getfield(L, -1, function_name.c_str());
-    bool result = lua_isfunction(L, -1);
-    lua_pop(L, 2);
+    lua_rawgetp(lua, LUA_REGISTRYINDEX, this);
+    lua_getfield(lua, -1, function_name.c_str());
+    bool result = lua_isfunction(lua, -1);
+    lua_pop(lua, 2);
     return result;
 }
 
+void Environment::post(Message message)
+{
+    if (!isolation)
+        return;
+    std::lock_guard<std::mutex> lock(isolation->mutex);
+    isolation->inbox.push_back(std::move(message));
+}
+
+std::vector<Message> Environment::takeMessages()
+{
+    std::vector<Message> result;
+    if (!isolation)
+        return result;
+    std::lock_guard<std::mutex> lock(isolation->mutex);
+    result.swap(isolation->outbox);
+    return result;
+}
+
+void Environment::updateIsolated(float delta)
+{
+    std::unique_lock<std::mutex> lock(isolated_environments_mutex);
+    if (isolated_environments.empty())
+        return;
+    SP_PROFILE_ZONE("isolated", "lua");
+    {
+        ThreadPool::Group group(ThreadPool::get());
+        for(auto env : isolated_environments)
+            group.submit([env, delta]() { env->updateIsolatedEnvironment(delta); });
+        group.wait();
+    }
+    // Played back without the lock, destroying an entity can run code that creates or destroys isolated environments.
+    //  The entities and components are only touched from this thread, after all isolated scripts are done.
+    lock.unlock();
+    isolated_commands.playback();
+}
+
+void Environment::updateIsolatedEnvironment(float delta)
+{
+    std::vector<Message> messages;
+    {
+        std::lock_guard<std::mutex> lock(isolation->mutex);
+        messages.swap(isolation->inbox);
+    }
+    if (!messages.empty() && isFunction("onMessage")) {
+        for(auto& message : messages) {
+            auto result = call<void>("onMessage", message);
+            if (result.isErr())
+                LOG(Error, "Isolated script onMessage failed: ", result.error());
+        }
+    }
+    if (isFunction("update")) {
+        auto result = call<void>("update", delta);
+        if (result.isErr())
+            LOG(Error, "Isolated script update failed: ", result.error());
+    }
+}
+
 int luaErrorHandler(lua_State* L)
 {
     const char * msg = lua_tostring(L, -1);
@@ -3,37 +3,97 @@
 
 #include "stringImproved.h"
 #include "script/conversion.h"
+#include "script/message.h"
 #include "result.h"
 #include "resources.h"
+#include "profiler.h"
 #include <lua/lua.hpp>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
 
 
 namespace sp::script {
 
 int luaErrorHandler(lua_State* L);
 
+namespace detail {
+    // Memory and instruction accounting of an environment. Lua objects can outlive the environment that created them,
+    //  so the budget is kept till all memory charged to it is freed.
+    struct Budget {
+        size_t memory_used = 0;
+        size_t memory_limit = 0;
+        uint64_t instructions = 0;
+        uint64_t instruction_limit = 0;
+        uint64_t frame = 0;
+        bool orphaned = false;
+
+        // Budget of the script that is running on this thread, new allocations and executed instructions are charged to it.
+        static thread_local Budget* current;
+        static std::atomic<uint64_t> current_frame;
+        // Find the budget of the environment the function at index was created in, nullptr if it does not use one.
+        static Budget* fromFunction(lua_State* L, int index);
+
+        static constexpr int hook_interval = 1000;
+        static void instructionHook(lua_State* L, lua_Debug* ar);
+    };
+
+    // Charge the lua code that runs on thread L within this scope to a budget. Only used around protected calls and resumes,
+    //  as running out of the memory budget raises a lua error.
+    //  The instruction hook is only set while a limited budget runs, as any hook makes lua check every instruction.
+    class BudgetScope : NonCopyable {
+    public:
+        BudgetScope(lua_State* L, Budget* budget) : L(L), previous(Budget::current), previous_hook_mask(lua_gethookmask(L)) {
+            if (!budget) return;
+            Budget::current = budget;
+            setHookMask(budget->instruction_limit ? LUA_MASKCOUNT : 0);
+        }
+        ~BudgetScope() {
+            Budget::current = previous;
+            setHookMask(previous_hook_mask);
+        }
+    private:
+        void setHookMask(int mask) {
+            if (lua_gethookmask(L) != mask)
+                lua_sethook(L, mask ? Budget::instructionHook : nullptr, mask, Budget::hook_interval);
+        }
+
+        lua_State* L;
+        Budget* previous;
+        int previous_hook_mask;
+    };
+}
+
 class Environment : NonCopyable
 {
 public:
+    struct Isolated {};
+    static constexpr Isolated isolated{};
+
     Environment(Environment* parent=nullptr);
+    // Create an environment with its own lua state. Isolated environments run their update function on worker threads
+    //  from updateIsolated, in parallel with each other. They have no access to the entities and components,
+    //  and exchange data with the rest of the game through messages and deferred component changes instead.
+    explicit Environment(Isolated);
     ~Environment();
 
     void setGlobalFuncWithEnvUpvalue(const string& name, lua_CFunction f) {
         //Get the environment table from the registry.
-        lua_rawgetp(L, LUA_REGISTRYINDEX, this);
-        lua_pushvalue(L, -1);
-        lua_pushcclosure(L, f, 1);
-        lua_setfield(L, -2, name.c_str());
-        lua_pop(L, 1);
+        lua_rawgetp(lua, LUA_REGISTRYINDEX, this);
+        lua_pushvalue(lua, -1);
+        lua_pushcclosure(lua, f, 1);
+        lua_setfield(lua, -2, name.c_str());
+        lua_pop(lua, 1);
     }
 
     template<typename T> void setGlobal(const string& name, const T& value) {
         //Get the environment table from the registry.
-        lua_rawgetp(L, LUA_REGISTRYINDEX, this);
-        if (Convert<T>::toLua(L, value) != 1)
-            luaL_error(L, "Trying to set global to a type that is not a single value");
-        lua_setfield(L, -2, name.c_str());
-        lua_pop(L, 1);
+        lua_rawgetp(lua, LUA_REGISTRYINDEX, this);
+        if (Convert<T>::toLua(lua, value) != 1)
+            luaL_error(lua, "Trying to set global to a type that is not a single value");
+        lua_setfield(lua, -2, name.c_str());
+        lua_pop(lua, 1);
     }
 
     template<typename T> Result<T> runFile(const string& filename)
@@ -44,7 +104,7 @@ public:
         auto code = stream->readAll();
         stream->destroy();
         stream = nullptr;
-        return runImpl<T>(code, "@" + filename);
+        return runImpl<T>(code, "@" + filename, true);
     }
 
     template<typename T> Result<T> run(const string& code) {
@@ -53,74 +113,118 @@ public:
 
     bool isFunction(const string& function_name);
 
+    // Limit the memory used by objects that scripts of this environment create. 0 is unlimited.
+    void setMemoryLimit(size_t bytes) { budget->memory_limit = bytes; }
+    size_t getMemoryUsage() const { return budget->memory_used; }
+    // Limit the lua instructions that scripts of this environment can run per frame. 0 is unlimited.
+    //  A coroutine that goes over the limit is paused till the next frame, other scripts are aborted with an error.
+    void setInstructionLimit(uint64_t instructions_per_frame) { budget->instruction_limit = instructions_per_frame; }
+
+    // Start a new frame for the instruction limits, and step the garbage collector for about gc_time seconds.
+    //  Called by the engine every frame. Once this is called, the garbage collector mostly runs from here,
+    //  so collection work is spread over frames instead of running whenever a script allocates.
+    //  Only when the heap doubles between two frames does lua collect from its allocations again.
+    static void updateFrame(float gc_time);
+
+    // Store the compiled bytecode of files run with runFile in this directory, so the next load can skip parsing.
+    //  Cache files are keyed on the content and name of the script, and are ignored when they do not match the lua version.
+    //  Empty disables the cache.
+    static void setBytecodeCacheDirectory(const string& path);
+
+    // Queue a message for an isolated environment. It is passed to its onMessage function at the start of the next updateIsolated.
+    void post(Message message);
+    // Take the messages that the scripts of an isolated environment sent with send(value).
+    std::vector<Message> takeMessages();
+
+    // Run the isolated environments in parallel on the ThreadPool. Each delivers its queued messages to onMessage,
+    //  and then calls update(delta). The scripts change components with setComponent(entity, name, value), which records
+    //  a removal for nil, or a replacement built from a table, in an ecs::CommandBuffer. Afterwards the buffer is played back
+    //  on the calling thread. Called by the engine every frame.
+    static void updateIsolated(float delta);
+
     template<typename T, typename... ARGS> Result<T> call(const string& function_name, const ARGS&... args) {
-        lua_pushcfunction(L, luaErrorHandler);
+        SP_PROFILE_ZONE("call", "lua");
+        lua_pushcfunction(lua, luaErrorHandler);
         //Try to find our function in the environment table
-        lua_rawgetp(L, LUA_REGISTRYINDEX, this);
-        lua_getfield(L, -1, function_name.c_str());
-        if (!lua_isfunction(L, -1)) {
-            lua_pop(L, 3);
+        lua_rawgetp(lua, LUA_REGISTRYINDEX, this);
+        lua_getfield(lua, -1, function_name.c_str());
+        if (!lua_isfunction(lua, -1)) {
+            lua_pop(lua, 3);
             return Result<T>::makeError("Not a function");
         }
         
-        int arg_count = (Convert<ARGS>::toLua(Environment::L, args) + ... + 0);
-        auto result = lua_pcall(L, arg_count, 1, -arg_count - 3);
+        int arg_count = (Convert<ARGS>::toLua(lua, args) + ... + 0);
+        detail::BudgetScope budget_scope(lua, budget);
+        auto result = lua_pcall(lua, arg_count, 1, -arg_count - 3);
         if (result)
         {
-            auto result = Result<T>::makeError(lua_tostring(L, -1));
-            lua_pop(L, 3);
+            auto result = Result<T>::makeError(lua_tostring(lua, -1));
+            lua_pop(lua, 3);
             return result;
         }
 
         if constexpr (!std::is_void_v<T>) {
-            auto return_value = Convert<T>::fromLua(L, -1);
-            lua_pop(L, 3);
+            auto return_value = Convert<T>::fromLua(lua, -1);
+            lua_pop(lua, 3);
             return return_value;
         } else {
-            lua_pop(L, 3);
+            lua_pop(lua, 3);
             return {};
         }
     }
 
 private:
-    template<typename T> Result<T> runImpl(const string& code, const string& name="=[string]") {
-        int stack_size = lua_gettop(L);
-        lua_pushcfunction(L, luaErrorHandler);
-        int result = luaL_loadbufferx(L, code.c_str(), code.length(), name.c_str(), "t");
+    template<typename T> Result<T> runImpl(const string& code, const string& name="=[string]", bool use_cache=false) {
+        SP_PROFILE_ZONE("run", "lua");
+        detail::BudgetScope budget_scope(lua, budget);
+        int stack_size = lua_gettop(lua);
+        lua_pushcfunction(lua, luaErrorHandler);
+        int result = load(lua, code, name, use_cache);
         if (result) {
-            auto res = Result<T>::makeError(luaL_checkstring(L, -1));
-            lua_settop(L, stack_size);
+            auto res = Result<T>::makeError(luaL_checkstring(lua, -1));
+            lua_settop(lua, stack_size);
             return res;
         }
 
         //Get the environment table from the registry.
-        lua_rawgetp(L, LUA_REGISTRYINDEX, this);
+        lua_rawgetp(lua, LUA_REGISTRYINDEX, this);
         //set the environment table it as 1st upvalue
-        lua_setupvalue(L, -2, 1);
+        lua_setupvalue(lua, -2, 1);
         
         int result_count = 1;
         if constexpr (std::is_same_v<T, CaptureAllResults>) {
             result_count = LUA_MULTRET;
         }
-        result = lua_pcall(L, 0, result_count, -2);
+        result = lua_pcall(lua, 0, result_count, -2);
         if (result) {
-            auto result = Result<T>::makeError(lua_tostring(L, -1));
-            lua_settop(L, stack_size);
+            auto result = Result<T>::makeError(lua_tostring(lua, -1));
+            lua_settop(lua, stack_size);
             return result;
         }
 
         if constexpr (!std::is_void_v<T>) {
-            auto return_value = Convert<T>::fromLua(L, -1);
-            lua_settop(L, stack_size);
+            auto return_value = Convert<T>::fromLua(lua, -1);
+            lua_settop(lua, stack_size);
             return return_value;
         } else {
-            lua_settop(L, stack_size);
+            lua_settop(lua, stack_size);
             return {};
         }
     }
 
+    void createEnvironmentTable(Environment* parent);
+    void updateIsolatedEnvironment(float delta);
+
+    // Push the compiled chunk, or the error message. Returns the lua status.
+    static int load(lua_State* L, const string& code, const string& name, bool use_cache);
+    static lua_State* newLuaState();
     static lua_State* getLuaState();
+    // The state shared by all environments that are not isolated.
     static lua_State* L;
+    lua_State* lua;
+    detail::Budget* budget;
+    struct Isolation;
+    std::unique_ptr<Isolation> isolation;
 
     template<typename T> friend class ComponentHandler;
     friend class LuaTableComponent;
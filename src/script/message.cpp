@@ -0,0 +1,185 @@
+#include "message.h"
+
+#include <cstring>
+
+
+namespace sp::script {
+
+namespace {
+// Nested tables deeper than this are refused, which also stops tables that contain themselves.
+static constexpr int max_depth = 32;
+// A table that is referenced more than once is serialized every time, so a few shared tables can describe a huge message.
+//  Messages that would serialize to more than this are refused.
+static constexpr size_t max_size = 16 * 1024 * 1024;
+
+enum class Tag : char
+{
+    Nil,
+    False,
+    True,
+    Integer,
+    Number,
+    String,
+    Entity,
+    Table,
+    TableEnd,
+};
+
+template<typename T> void append(std::string& data, const T& value)
+{
+    data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T> T extract(const std::string& data, size_t& position)
+{
+    T value;
+    memcpy(&value, data.data() + position, sizeof(value));
+    position += sizeof(value);
+    return value;
+}
+}
+
+Message Message::fromLua(lua_State* L, int index)
+{
+    // Lua errors skip C++ destructors, so the value is checked before there is anything to clean up.
+    index = lua_absindex(L, index);
+    size_t size = 0;
+    check(L, index, 0, size);
+    Message result;
+    result.write(L, index);
+    return result;
+}
+
+int Message::toLua(lua_State* L) const
+{
+    if (data.empty())
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    read(L, 0);
+    return 1;
+}
+
+// Adds the size that write() will produce for the value to size.
+void Message::check(lua_State* L, int index, int depth, size_t& size)
+{
+    size += sizeof(Tag);
+    switch(lua_type(L, index))
+    {
+    case LUA_TNONE:
+    case LUA_TNIL:
+    case LUA_TBOOLEAN:
+        break;
+    case LUA_TNUMBER:
+        size += sizeof(lua_Integer) > sizeof(lua_Number) ? sizeof(lua_Integer) : sizeof(lua_Number);
+        break;
+    case LUA_TSTRING:
+        size += sizeof(size_t) + lua_rawlen(L, index);
+        break;
+    case LUA_TLIGHTUSERDATA:
+        size += sizeof(ecs::Entity);
+        break;
+    case LUA_TTABLE:
+        if (depth >= max_depth)
+            luaL_error(L, "Message tables nested too deep");
+        size += sizeof(Tag);
+        luaL_checkstack(L, 2, nullptr);
+        lua_pushnil(L);
+        while(lua_next(L, index))
+        {
+            check(L, lua_gettop(L) - 1, depth + 1, size);
+            check(L, lua_gettop(L), depth + 1, size);
+            lua_pop(L, 1);
+        }
+        break;
+    default:
+        luaL_error(L, "Cannot send a %s in a message", luaL_typename(L, index));
+    }
+    // Checked for every value, so the walk over a shared table stops as soon as the limit is reached.
+    if (size > max_size)
+        luaL_error(L, "Message is larger than %d bytes", static_cast<int>(max_size));
+}
+
+void Message::write(lua_State* L, int index)
+{
+    switch(lua_type(L, index))
+    {
+    case LUA_TNONE:
+    case LUA_TNIL:
+        append(data, Tag::Nil);
+        break;
+    case LUA_TBOOLEAN:
+        append(data, lua_toboolean(L, index) ? Tag::True : Tag::False);
+        break;
+    case LUA_TNUMBER:
+        if (lua_isinteger(L, index))
+        {
+            append(data, Tag::Integer);
+            append(data, lua_tointeger(L, index));
+        }
+        else
+        {
+            append(data, Tag::Number);
+            append(data, lua_tonumber(L, index));
+        }
+        break;
+    case LUA_TSTRING:{
+        size_t size;
+        auto str = lua_tolstring(L, index, &size);
+        append(data, Tag::String);
+        append(data, size);
+        data.append(str, size);
+        }break;
+    case LUA_TLIGHTUSERDATA:
+        append(data, Tag::Entity);
+        append(data, Convert<ecs::Entity>::fromLua(L, index));
+        break;
+    case LUA_TTABLE:
+        append(data, Tag::Table);
+        lua_pushnil(L);
+        while(lua_next(L, index))
+        {
+            write(L, lua_gettop(L) - 1);
+            write(L, lua_gettop(L));
+            lua_pop(L, 1);
+        }
+        append(data, Tag::TableEnd);
+        break;
+    }
+}
+
+size_t Message::read(lua_State* L, size_t position) const
+{
+    auto tag = extract<Tag>(data, position);
+    switch(tag)
+    {
+    case Tag::Nil: lua_pushnil(L); break;
+    case Tag::False: lua_pushboolean(L, false); break;
+    case Tag::True: lua_pushboolean(L, true); break;
+    case Tag::Integer: lua_pushinteger(L, extract<lua_Integer>(data, position)); break;
+    case Tag::Number: lua_pushnumber(L, extract<lua_Number>(data, position)); break;
+    case Tag::String:{
+        auto size = extract<size_t>(data, position);
+        lua_pushlstring(L, data.data() + position, size);
+        position += size;
+        }break;
+    case Tag::Entity: Convert<ecs::Entity>::toLua(L, extract<ecs::Entity>(data, position)); break;
+    case Tag::Table:
+        luaL_checkstack(L, 3, nullptr);
+        lua_newtable(L);
+        while(static_cast<Tag>(data[position]) != Tag::TableEnd)
+        {
+            position = read(L, position);
+            position = read(L, position);
+            lua_rawset(L, -3);
+        }
+        position++;
+        break;
+    case Tag::TableEnd:
+        break;
+    }
+    return position;
+}
+
+}
@@ -0,0 +1,37 @@
+#ifndef SP_SCRIPT_MESSAGE
+#define SP_SCRIPT_MESSAGE
+
+#include "script/conversion.h"
+#include <string>
+
+
+namespace sp::script {
+
+/** A lua value that can be moved between lua states: nil, booleans, numbers, strings, entities, and tables of those.
+    The value is stored serialized, so a message can be created in one state and unpacked in another on a different thread.
+ */
+class Message
+{
+public:
+    // Serialize the value at index. Raises a lua error for values that cannot be moved between states.
+    static Message fromLua(lua_State* L, int index);
+    // Push the value, returns the number of pushed values.
+    int toLua(lua_State* L) const;
+
+    bool empty() const { return data.empty(); }
+private:
+    static void check(lua_State* L, int index, int depth, size_t& size);
+    void write(lua_State* L, int index);
+    size_t read(lua_State* L, size_t position) const;
+
+    std::string data;
+};
+
+template<> struct Convert<Message> {
+    static int toLua(lua_State* L, const Message& value) { return value.toLua(L); }
+    static Message fromLua(lua_State* L, int idx) { return Message::fromLua(L, idx); }
+};
+
+}
+
+#endif//SP_SCRIPT_MESSAGE
@@ -0,0 +1,249 @@
+#include "scheduler.h"
+#include "profiler.h"
+#include "logging.h"
+
+#include <array>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+namespace sp::script {
+
+namespace {
+static constexpr double tick_length = 0.01;
+static constexpr int wheel_bits = 6;
+static constexpr uint64_t wheel_size = 1 << wheel_bits;
+static constexpr int wheel_levels = 4;
+// Longer waits are clamped to this, which is still millions of years, so converting the delay to ticks cannot overflow.
+static constexpr double max_wait_ticks = double(std::numeric_limits<uint64_t>::max() / 2);
+
+struct Timer
+{
+    CoroutinePtr coroutine;
+    uint64_t expires;
+};
+
+// Level 0 holds the timers of the next wheel_size ticks, one slot per tick. Each next level covers wheel_size times
+//  the range of the previous one. When the lower level wraps around, the timers in the next slot of the level above
+//  are moved down, so each timer is touched at most once per level.
+struct State
+{
+    std::array<std::array<std::vector<Timer>, wheel_size>, wheel_levels> wheel;
+    size_t timer_count = 0;
+    uint64_t now_tick = 0;
+    double time = 0.0;
+
+    std::unordered_map<string, std::vector<CoroutinePtr>> events;
+    size_t event_waiting_count = 0;
+    std::vector<CoroutinePtr> ready;
+    std::vector<CoroutinePtr> resuming;
+};
+
+State& state()
+{
+    static State instance;
+    return instance;
+}
+
+void insertTimer(State& s, Timer&& timer)
+{
+    auto delta = timer.expires - s.now_tick;
+    for(int level=0; level<wheel_levels; level++)
+    {
+        auto shift = wheel_bits * level;
+        if (level == wheel_levels - 1 && (delta >> shift) >= wheel_size)
+        {
+            // Beyond the range of the wheel, park it in the last slot of the top level, it is inserted again from there.
+            s.wheel[level][((s.now_tick >> shift) - 1) & (wheel_size - 1)].emplace_back(std::move(timer));
+            return;
+        }
+        if ((delta >> shift) < wheel_size)
+        {
+            s.wheel[level][(timer.expires >> shift) & (wheel_size - 1)].emplace_back(std::move(timer));
+            return;
+        }
+    }
+}
+
+}
+
+// Look at what the coroutine yielded, and park it till that happens.
+void Scheduler::park(CoroutinePtr&& coroutine)
+{
+    auto& s = state();
+    auto L = coroutine->lua;
+    int count = coroutine->yielded;
+    int type = count > 0 ? lua_type(L, -count) : LUA_TNONE;
+    if (type == LUA_TNUMBER)
+    {
+        auto delay = lua_tonumber(L, -count);
+        auto ticks = delay > 0.0 ? static_cast<uint64_t>(std::min(std::ceil(delay / tick_length), max_wait_ticks)) : 0;
+        // At least one tick, the slot of the current tick has been handled already.
+        insertTimer(s, {std::move(coroutine), s.now_tick + std::max<uint64_t>(ticks, 1)});
+        s.timer_count++;
+    }
+    else if (type == LUA_TSTRING)
+    {
+        s.events[lua_tostring(L, -count)].emplace_back(std::move(coroutine));
+        s.event_waiting_count++;
+    }
+    else
+    {
+        s.ready.emplace_back(std::move(coroutine));
+    }
+}
+
+void Scheduler::resume(CoroutinePtr&& coroutine)
+{
+    auto result = coroutine->resume();
+    if (result.isErr())
+    {
+        LOG(Error, "Scheduled coroutine failed: ", result.error());
+        return;
+    }
+    if (result.value())
+        park(std::move(coroutine));
+}
+
+void Scheduler::tick()
+{
+    auto& s = state();
+    s.now_tick++;
+    std::vector<Timer> timers;
+    for(int level=1; level<wheel_levels; level++)
+    {
+        auto shift = wheel_bits * level;
+        if (s.now_tick & ((uint64_t(1) << shift) - 1))
+            break;
+        timers.swap(s.wheel[level][(s.now_tick >> shift) & (wheel_size - 1)]);
+        for(auto& timer : timers)
+            insertTimer(s, std::move(timer));
+        timers.clear();
+    }
+
+    // Swapped out, as the resumed coroutines can add new timers.
+    timers.swap(s.wheel[0][s.now_tick & (wheel_size - 1)]);
+    s.timer_count -= timers.size();
+    for(auto& timer : timers)
+        resume(std::move(timer.coroutine));
+}
+
+void Scheduler::add(CoroutinePtr coroutine)
+{
+    if (coroutine)
+        park(std::move(coroutine));
+}
+
+void Scheduler::signal(const string& event)
+{
+    auto& s = state();
+    auto it = s.events.find(event);
+    if (it == s.events.end())
+        return;
+    // Taken out of the map first, as a condition could signal events itself.
+    auto waiting = std::move(it->second);
+    s.events.erase(it);
+    s.event_waiting_count -= waiting.size();
+    std::vector<CoroutinePtr> still_waiting;
+    for(auto& coroutine : waiting)
+    {
+        if (conditionHolds(*coroutine))
+            s.ready.emplace_back(std::move(coroutine));
+        else
+            still_waiting.emplace_back(std::move(coroutine));
+    }
+    if (!still_waiting.empty())
+    {
+        auto& list = s.events[event];
+        s.event_waiting_count += still_waiting.size();
+        for(auto& coroutine : still_waiting)
+            list.emplace_back(std::move(coroutine));
+    }
+}
+
+// The condition is the function yielded after the event name, it stays on the stack of the coroutine while it waits.
+//  A suspended coroutine cannot run functions itself, so the condition runs on a new thread of the same lua state.
+bool Scheduler::conditionHolds(Coroutine& coroutine)
+{
+    auto L = coroutine.lua;
+    if (!L || coroutine.yielded < 2 || lua_type(L, -coroutine.yielded + 1) != LUA_TFUNCTION)
+        return true;
+    auto thread = lua_newthread(L);
+    lua_pushvalue(L, -coroutine.yielded);
+    lua_xmove(L, thread, 1);
+    bool result = true;
+    {
+        detail::BudgetScope budget_scope(thread, coroutine.budget);
+        if (lua_pcall(thread, 0, 1, 0) != LUA_OK)
+            LOG(Error, "waitFor condition failed: ", lua_tostring(thread, -1));
+        else
+            result = lua_toboolean(thread, -1);
+    }
+    lua_pop(L, 1);
+    return result;
+}
+
+void Scheduler::update(float delta)
+{
+    auto& s = state();
+    if (s.timer_count == 0 && s.ready.empty())
+    {
+        s.time += delta;
+        s.now_tick = static_cast<uint64_t>(s.time / tick_length);
+        return;
+    }
+    SP_PROFILE_ZONE("scheduler", "lua");
+
+    // Coroutines that become ready while these run are resumed on the next update.
+    std::swap(s.ready, s.resuming);
+    for(auto& coroutine : s.resuming)
+        resume(std::move(coroutine));
+    s.resuming.clear();
+
+    s.time += delta;
+    auto target_tick = static_cast<uint64_t>(s.time / tick_length);
+    while(s.now_tick < target_tick)
+    {
+        if (s.timer_count == 0)
+        {
+            s.now_tick = target_tick;
+            break;
+        }
+        tick();
+    }
+}
+
+size_t Scheduler::getWaitingCount()
+{
+    auto& s = state();
+    return s.timer_count + s.event_waiting_count + s.ready.size();
+}
+
+int luaWait(lua_State* L)
+{
+    luaL_optnumber(L, 1, 0.0);
+    lua_settop(L, 1);
+    return lua_yield(L, 1);
+}
+
+int luaWaitFor(lua_State* L)
+{
+    luaL_checkstring(L, 1);
+    if (lua_isnoneornil(L, 2))
+    {
+        lua_settop(L, 1);
+        return lua_yield(L, 1);
+    }
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    lua_settop(L, 2);
+    return lua_yield(L, 2);
+}
+
+int luaSignal(lua_State* L)
+{
+    Scheduler::signal(luaL_checkstring(L, 1));
+    return 0;
+}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <script/coroutine.h>
+#include <stringImproved.h>
+
+namespace sp::script {
+
+/** Resumes coroutines from the engine loop, so game code does not have to poll them.
+ *  What a coroutine waits for is given by the value it yields:
+ *   a number waits that many seconds, a string waits till that event is signaled, nothing waits for the next frame.
+ *   A function after the event string is a condition, which is checked when the event is signaled. The coroutine keeps waiting while it returns false.
+ *  Timers are kept in a hierarchical timer wheel, so the cost of a frame depends on the coroutines that wake up,
+ *  not on the number of coroutines that are waiting.
+ */
+class Scheduler
+{
+public:
+    // Take over a coroutine that yielded, it is resumed when what it yielded for happens.
+    static void add(CoroutinePtr coroutine);
+    // Wake up all coroutines that wait for this event, they are resumed on the next update.
+    static void signal(const string& event);
+
+    // Called by the engine every frame with the game time that passed.
+    static void update(float delta);
+
+    // Number of coroutines that wait for a timer, an event or the next frame.
+    static size_t getWaitingCount();
+private:
+    static void park(CoroutinePtr&& coroutine);
+    static void resume(CoroutinePtr&& coroutine);
+    static bool conditionHolds(Coroutine& coroutine);
+    static void tick();
+};
+
+// Lua functions for coroutines run by the Scheduler, register them in an environment with setGlobal.
+// wait(seconds): resume after the given game time, or on the next frame without seconds.
+int luaWait(lua_State* L);
+// waitFor(event): resume after signal(event) is called.
+// waitFor(event, condition): resume after signal(event) is called while condition() returns true.
+int luaWaitFor(lua_State* L);
+// signal(event): wake up the coroutines that wait for the event.
+int luaSignal(lua_State* L);
+
+}
@@ -1,11 +1,123 @@
 #include "logging.h"
 #include "resources.h"
 #include "textureManager.h"
+#include "timer.h"
 #include "graphics/image.h"
 #include "graphics/ktx2texture.h"
+#include "threadPool.h"
+#include <algorithm>
 
 TextureManager textureManager;
 
+// filename variants:
+//  name
+//  name.notanextension
+//  name.ext
+//  name.notanext.ext
+// Attempt to load the best version.
+P<ResourceStream> TextureManager::openKTX2Stream(std::string_view name)
+{
+    P<ResourceStream> stream;
+    auto last_dot = name.find_last_of('.');
+    if (last_dot != std::string::npos)
+    {
+        // Extension found, try and substitute it.
+        stream = getResourceStream(string(name.substr(0, last_dot)) + ".ktx2");
+    }
+
+    if (!stream)
+    {
+        // No extension, or substitution failed (maybe it wasn't an extension), blindly add it.
+        stream = getResourceStream(string(name) + ".ktx2");
+    }
+    return stream;
+}
+
+P<ResourceStream> TextureManager::openImageStream(std::string_view name)
+{
+    auto stream = getResourceStream(string(name));
+    if (!stream)
+        stream = getResourceStream(string(name) + ".png");
+    return stream;
+}
+
+static P<ResourceStream> openTextureStream(const string& name, bool& is_ktx2)
+{
+    auto stream = TextureManager::openKTX2Stream(name);
+    is_ktx2 = bool(stream);
+    if (!stream)
+        stream = TextureManager::openImageStream(name);
+    return stream;
+}
+
+class TextureLoadJob : public TextureManager::BackgroundJob
+{
+public:
+    TextureLoadJob(const string& name, std::vector<uint8_t>&& data, bool is_ktx2, uint32_t base_mip_level)
+    : name(name), data(std::move(data)), is_ktx2(is_ktx2), base_mip_level(base_mip_level)
+    {
+    }
+
+    virtual void decode() override
+    {
+        if (is_ktx2)
+        {
+            sp::KTX2Texture ktxtexture;
+            if (ktxtexture.loadFromMemory(std::move(data)))
+            {
+                auto mip_level = std::min(base_mip_level, ktxtexture.getMipCount() - 1);
+                native_pixels = ktxtexture.toNative(mip_level);
+                native_size = ktxtexture.getNativeSize(mip_level);
+                native_format = ktxtexture.getNativeFormat();
+            }
+        }
+        else
+        {
+            image.loadFromMemory(data.data(), data.size());
+        }
+        data.clear();
+    }
+
+    virtual void finish() override
+    {
+        textureManager.pendingTextures.erase(name);
+        if (textureManager.textureMap[name])
+            return;
+
+        std::unique_ptr<sp::BasicTexture> texture;
+        if (!native_pixels.empty())
+        {
+            texture = std::make_unique<sp::BasicTexture>(native_size, native_pixels, native_format);
+        }
+        else
+        {
+            if (image.getSize().x == 0 || image.getSize().y == 0)
+            {
+                LOG(WARNING) << "Failed to load texture: " << name;
+                image = sp::Image({ 8, 8 }, { 255, 0, 255, 128 });
+            }
+            texture = std::make_unique<sp::BasicTexture>(image);
+        }
+        texture->setRepeated(textureManager.defaultRepeated);
+        texture->setSmooth(textureManager.defaultSmooth);
+
+        textureManager.textureMap[name] = texture.get();
+        LOG(INFO) << "Loaded: " << name;
+        texture.release();
+    }
+
+private:
+    string name;
+    std::vector<uint8_t> data;
+    bool is_ktx2;
+    uint32_t base_mip_level;
+
+    sp::Image image;
+    std::vector<uint8_t> native_pixels;
+    glm::ivec2 native_size;
+    uint32_t native_format = 0;
+};
+
 TextureManager::TextureManager()
 {
     defaultRepeated = false;
@@ -14,45 +126,108 @@ TextureManager::TextureManager()
     disabled = false;
 }
 
-TextureManager::~TextureManager()
-{
-}
-
 sp::Texture* TextureManager::getTexture(const string& name)
 {
     if (disabled)
         return nullptr;
     sp::Texture* data = textureMap[name];
     if (data == nullptr)
+    {
+        if (backgroundLoading)
+        {
+            queueTexture(name);
+            //Textures that do not exist are not queued, but get their fallback texture right away.
+            data = textureMap[name];
+            if (data)
+                return data;
+            if (!placeholderTexture)
+                placeholderTexture = std::make_unique<sp::BasicTexture>(sp::Image({1, 1}, {0, 0, 0, 0}));
+            return placeholderTexture.get();
+        }
         return loadTexture(name);
+    }
     return data;
 }
 
-sp::Texture* TextureManager::loadTexture(const string& name)
+void TextureManager::prefetch(const std::vector<string>& names)
 {
-    P<ResourceStream> stream;
-    // filename variants:
-    //  name
-    //  name.notanextension
-    //  name.ext
-    //  name.notanext.ext
-    // Attempt to load the best version.
-    auto last_dot = name.find_last_of('.');
-    if (last_dot != std::string::npos)
+    if (disabled)
+        return;
+    for(const auto& name : names)
     {
-        // Extension found, try and substitute it.
-        stream = getResourceStream(name.substr(0, static_cast<uint32_t>(last_dot)) + ".ktx2");
+        auto it = textureMap.find(name);
+        if (it == textureMap.end() || it->second == nullptr)
+            queueTexture(name);
     }
+}
 
+bool TextureManager::isLoading()
+{
+    return jobsInProgress > 0;
+}
+
+void TextureManager::queueBackgroundJob(std::unique_ptr<BackgroundJob> job)
+{
+    jobsInProgress++;
+    //ThreadPool jobs have to be copyable, so the job is passed as a raw pointer and owned by the finish queue again after decoding.
+    sp::ThreadPool::get().submit([this, job=job.release()]()
+    {
+        job->decode();
+        std::lock_guard<std::mutex> lock(jobMutex);
+        finishQueue.emplace_back(job);
+    });
+}
+
+void TextureManager::update()
+{
+    if (jobsInProgress == 0)
+        return;
+    //Without worker threads nothing else runs the decode jobs, so decode one each frame here.
+    if (sp::ThreadPool::get().getWorkerCount() == 0)
+        sp::ThreadPool::get().runOne();
+
+    sp::SystemStopwatch upload_stopwatch;
+    do
+    {
+        std::unique_ptr<BackgroundJob> job;
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            if (finishQueue.empty())
+                break;
+            job = std::move(finishQueue.front());
+            finishQueue.pop_front();
+        }
+        job->finish();
+        jobsInProgress--;
+    } while(upload_stopwatch.get() < uploadTimeBudget);
+}
+
+void TextureManager::queueTexture(const string& name)
+{
+    if (pendingTextures.find(name) != pendingTextures.end())
+        return;
+    //Finding and reading the file is done here, as resource streams cannot be used from other threads.
+    bool is_ktx2;
+    auto stream = openTextureStream(name, is_ktx2);
     if (!stream)
     {
-        // No extension, or substitution failed (maybe it wasn't an extension), blindly add it.
-        stream = getResourceStream(name + ".ktx2");
+        loadTexture(name);
+        return;
     }
+    std::vector<uint8_t> data(stream->getSize());
+    stream->read(data.data(), data.size());
+    pendingTextures.insert(name);
+    queueBackgroundJob(std::make_unique<TextureLoadJob>(name, std::move(data), is_ktx2, getBaseMipLevel()));
+}
+
+sp::Texture* TextureManager::loadTexture(const string& name)
+{
+    bool is_ktx2;
+    P<ResourceStream> stream = openTextureStream(name, is_ktx2);
 
     std::unique_ptr<sp::BasicTexture> texture;
     sp::KTX2Texture ktxtexture;
-    if (stream)
+    if (stream && is_ktx2)
     {
         if (ktxtexture.loadFromStream(stream))
         {
@@ -67,13 +242,8 @@ sp::Texture* TextureManager::loadTexture(const string& name)
     if (!texture)
     {
         sp::Image image;
-        if (!stream)
-        {
-            stream = getResourceStream(name);
-            if (!stream)
-                stream = getResourceStream(string(name) + ".png");
+        if (!is_ktx2)
             image.loadFromStream(stream);
-        }
 
         if (image.getSize().x == 0 || image.getSize().y == 0)
         {
@@ -2,37 +2,87 @@
 #define TEXTURE_MANAGER_H
 
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string_view>
 #include "stringImproved.h"
+#include "resources.h"
 #include "graphics/texture.h"
 
 class TextureManager;
 extern TextureManager textureManager;
 class TextureManager
 {
+public:
+    /**
+        Work that is split in a part that runs on a background thread, and a part that runs on the main thread.
+        The background part does the CPU heavy decoding, the main thread part uploads the result to the GPU.
+     */
+    class BackgroundJob
+    {
+    public:
+        virtual ~BackgroundJob() = default;
+        //Runs on a worker thread. Cannot use OpenGL, and cannot create or release PObjects.
+        virtual void decode() = 0;
+        //Runs on the main thread from TextureManager::update()
+        virtual void finish() = 0;
+    };
 private:
     uint32_t baseMipLevel = 0;
     bool defaultRepeated;
     bool defaultSmooth;
     bool autoSprite;
     bool disabled;  //Allow to disable to texture manager, which does not load anything. For headless runs.
+    bool backgroundLoading = false;
+    float uploadTimeBudget = 0.004f;
     std::unordered_map<string, sp::Texture*> textureMap;
+    std::unordered_set<string> pendingTextures;
+    std::unique_ptr<sp::Texture> placeholderTexture;
+
+    std::mutex jobMutex;
+    std::deque<std::unique_ptr<BackgroundJob>> finishQueue;
+    size_t jobsInProgress = 0;
 public:
     TextureManager();
-    ~TextureManager();
 
     void setBaseMipLevel(uint32_t baseMip) { baseMipLevel = baseMip; }
     void setDefaultRepeated(bool repeated) { defaultRepeated = repeated; }
     void setDefaultSmooth(bool smooth) { defaultSmooth = smooth; }
     void setDisabled(bool disable) { disabled = disable; }
+    //With background loading enabled, getTexture() returns a transparent placeholder until the texture is decoded and uploaded.
+    //The RenderTarget does the same for sprites and images.
+    void setBackgroundLoading(bool enabled) { backgroundLoading = enabled; }
+    //Maximum time in seconds spend each frame on uploading textures that finished decoding. At least one texture is uploaded each frame.
+    void setUploadTimeBudget(float seconds) { uploadTimeBudget = seconds; }
 
     uint32_t getBaseMipLevel() const { return baseMipLevel; }
     bool isDefaultRepeated() { return defaultRepeated; }
     bool isDefaultSmoothFiltering() { return defaultSmooth; }
+    bool isBackgroundLoading() const { return backgroundLoading; }
 
     sp::Texture* getTexture(const string& name);
+    //Start loading these textures in the background, so they are ready when they are needed.
+    void prefetch(const std::vector<string>& names);
+    //True while there are still background jobs that are not finished.
+    bool isLoading();
+
+    //Decodes on the sp::ThreadPool, and finishes on the main thread from update().
+    void queueBackgroundJob(std::unique_ptr<BackgroundJob> job);
+    //Finish jobs that completed decoding, called from the engine main loop each frame.
+    void update();
+
+    //Find the .ktx2 version of a texture: the name with its extension replaced by .ktx2, or with .ktx2 added.
+    static P<ResourceStream> openKTX2Stream(std::string_view name);
+    //Find a texture as an image file: the name itself, or the name with .png added.
+    static P<ResourceStream> openImageStream(std::string_view name);
 private:
     sp::Texture* loadTexture(const string& name);
+    void queueTexture(const string& name);
+
+    friend class TextureLoadJob;
 };
 
 #endif//TEXTURE_MANAGER_H
@@ -0,0 +1,147 @@
+#include "threadPool.h"
+
+#include <algorithm>
+#include <limits>
+
+
+namespace sp {
+
+//Index of the worker the current thread is, or no_worker for threads outside of any pool.
+static constexpr size_t no_worker = std::numeric_limits<size_t>::max();
+static thread_local ThreadPool* current_pool = nullptr;
+static thread_local size_t current_worker = no_worker;
+
+ThreadPool& ThreadPool::get()
+{
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+ThreadPool::ThreadPool(size_t worker_count)
+{
+    for(size_t n=0; n<worker_count; n++)
+        workers.emplace_back(std::make_unique<Worker>());
+    for(size_t n=0; n<worker_count; n++)
+        workers[n]->thread = std::thread(&ThreadPool::workerThread, this, n);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stop = true;
+    }
+    wakeup.notify_all();
+    for(auto& worker : workers)
+        worker->thread.join();
+}
+
+void ThreadPool::submit(Job job)
+{
+    {
+        //Take the lock so a worker that is about to sleep cannot miss this job.
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        queued++;
+    }
+    if (workers.empty())
+    {
+        std::lock_guard<std::mutex> lock(overflow_mutex);
+        overflow.push_back(std::move(job));
+    }
+    else
+    {
+        size_t index = (current_pool == this) ? current_worker : next_worker++ % workers.size();
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->jobs.push_back(std::move(job));
+    }
+    wakeup.notify_one();
+}
+
+bool ThreadPool::runOne()
+{
+    Job job;
+    if (!take(current_pool == this ? current_worker : no_worker, job))
+        return false;
+    job();
+    return true;
+}
+
+bool ThreadPool::take(size_t preferred, Job& job)
+{
+    if (queued == 0)
+        return false;
+    //Own jobs are taken newest first, as their data is most likely still in cache. Stolen jobs are taken oldest first.
+    if (preferred != no_worker)
+    {
+        auto& worker = *workers[preferred];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.jobs.empty())
+        {
+            job = std::move(worker.jobs.back());
+            worker.jobs.pop_back();
+            queued--;
+            return true;
+        }
+    }
+    for(size_t n=0; n<workers.size(); n++)
+    {
+        auto& worker = *workers[(preferred + 1 + n) % workers.size()];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.jobs.empty())
+        {
+            job = std::move(worker.jobs.front());
+            worker.jobs.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    std::lock_guard<std::mutex> lock(overflow_mutex);
+    if (!overflow.empty())
+    {
+        job = std::move(overflow.front());
+        overflow.pop_front();
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::workerThread(size_t index)
+{
+    current_pool = this;
+    current_worker = index;
+    while(true)
+    {
+        Job job;
+        if (take(index, job))
+        {
+            job();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wakeup.wait(lock, [this]() { return stop || queued > 0; });
+        if (stop)
+            return;
+    }
+}
+
+void ThreadPool::Group::submit(Job job)
+{
+    pending++;
+    pool.submit([this, job=std::move(job)]()
+    {
+        job();
+        pending--;
+    });
+}
+
+void ThreadPool::Group::wait()
+{
+    while(pending > 0)
+    {
+        if (!pool.runOne())
+            std::this_thread::yield();
+    }
+}
+
+}//namespace sp
@@ -0,0 +1,79 @@
+#ifndef SP_THREAD_POOL_H
+#define SP_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "nonCopyable.h"
+
+
+namespace sp {
+
+/**
+    Pool of worker threads for CPU bound jobs, like the systems of a frame and the decoding of textures.
+    Each worker has its own job queue, jobs submitted from a worker go to its own queue and idle workers steal from the others.
+    The thread that waits for jobs to finish helps out with running jobs, so nothing deadlocks on machines with a single core.
+    Jobs cannot use OpenGL, and cannot create or release PObjects.
+ */
+class ThreadPool : sp::NonCopyable
+{
+public:
+    using Job = std::function<void()>;
+
+    //The shared pool, workers are started on first use. One worker less then there are cores, as the main thread helps out.
+    static ThreadPool& get();
+
+    explicit ThreadPool(size_t worker_count);
+    ~ThreadPool();
+
+    size_t getWorkerCount() const { return workers.size(); }
+
+    void submit(Job job);
+    //Run a single queued job on the calling thread, returns false if there was nothing to run.
+    bool runOne();
+
+    /**
+        Tracks a set of jobs, so the caller can wait for all of them.
+        Waiting runs queued jobs on the waiting thread instead of blocking.
+     */
+    class Group : sp::NonCopyable
+    {
+    public:
+        Group(ThreadPool& pool) : pool(pool) {}
+        ~Group() { wait(); }
+
+        void submit(Job job);
+        void wait();
+    private:
+        ThreadPool& pool;
+        std::atomic<size_t> pending{0};
+    };
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        std::thread thread;
+    };
+
+    bool take(size_t preferred, Job& job);
+    void workerThread(size_t index);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::deque<Job> overflow;  //Jobs submitted from outside the pool, when there are no workers.
+    std::mutex overflow_mutex;
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> next_worker{0};
+    std::mutex sleep_mutex;
+    std::condition_variable wakeup;
+    bool stop = false;
+};
+
+}//namespace sp
+
+#endif//SP_THREAD_POOL_H
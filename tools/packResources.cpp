@@ -0,0 +1,130 @@
+/**
+    Packs a resource directory into a single file for the PackResourceProvider.
+    Usage: sp_pack <resource directory> <output file> [compression level]
+    Entries are compressed with zstd when that makes them at least 10% smaller, already compressed formats (png, ogg, ktx2) are stored as is.
+ */
+#include "resourcePack.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <zstd/zstd.h>
+
+namespace fs = std::filesystem;
+using namespace sp::resourcepack;
+
+struct PackFile
+{
+    std::string name;
+    std::vector<char> data;
+    Entry entry{};
+};
+
+static bool readFile(const fs::path& path, std::vector<char>& data)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !file.bad();
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <resource directory> <output file> [compression level]\n", argv[0]);
+        return 1;
+    }
+    const fs::path root{argv[1]};
+    const int level = argc > 3 ? atoi(argv[3]) : 19;
+
+    std::vector<PackFile> files;
+    std::error_code error_code{};
+    for(const auto& entry : fs::recursive_directory_iterator(root, fs::directory_options::follow_directory_symlink, error_code))
+    {
+        if (entry.is_directory())
+            continue;
+        PackFile file;
+        file.name = entry.path().lexically_relative(root).generic_u8string();
+        if (!readFile(entry.path(), file.data))
+        {
+            fprintf(stderr, "Failed to read %s\n", entry.path().u8string().c_str());
+            return 1;
+        }
+        files.push_back(std::move(file));
+    }
+    if (error_code)
+    {
+        fprintf(stderr, "Failed to read directory %s: %s\n", argv[1], error_code.message().c_str());
+        return 1;
+    }
+
+    std::string names;
+    for(auto& file : files)
+    {
+        file.entry.name_hash = hashName(file.name);
+        file.entry.name_offset = static_cast<uint32_t>(names.size());
+        file.entry.name_length = static_cast<uint32_t>(file.name.size());
+        file.entry.size = file.data.size();
+        names += file.name;
+
+        auto extension = fs::path(file.name).extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if (extension == ".png" || extension == ".jpg" || extension == ".ogg" || extension == ".ktx2" || extension == ".opus")
+            continue;
+        std::vector<char> compressed(ZSTD_compressBound(file.data.size()));
+        auto result = ZSTD_compress(compressed.data(), compressed.size(), file.data.data(), file.data.size(), level);
+        if (!ZSTD_isError(result) && result < file.data.size() * 9 / 10)
+        {
+            compressed.resize(result);
+            file.data = std::move(compressed);
+            file.entry.flags |= FlagZstd;
+        }
+    }
+    std::sort(files.begin(), files.end(), [](const PackFile& a, const PackFile& b) { return a.entry.name_hash < b.entry.name_hash; });
+
+    Header header{};
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.entry_count = static_cast<uint32_t>(files.size());
+    header.names_size = static_cast<uint32_t>(names.size());
+
+    //Align the data of every entry to 16 bytes, so users of the mapped memory get aligned data.
+    uint64_t offset = sizeof(Header) + files.size() * sizeof(Entry) + names.size();
+    for(auto& file : files)
+    {
+        offset = (offset + 15) & ~uint64_t(15);
+        file.entry.offset = offset;
+        file.entry.stored_size = file.data.size();
+        offset += file.data.size();
+    }
+
+    std::ofstream output(argv[2], std::ios::binary);
+    if (!output)
+    {
+        fprintf(stderr, "Failed to create %s\n", argv[2]);
+        return 1;
+    }
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for(auto& file : files)
+        output.write(reinterpret_cast<const char*>(&file.entry), sizeof(file.entry));
+    output.write(names.data(), names.size());
+    for(auto& file : files)
+    {
+        static const char padding[16] = {};
+        output.write(padding, file.entry.offset - static_cast<uint64_t>(output.tellp()));
+        output.write(file.data.data(), file.data.size());
+    }
+    if (!output)
+    {
+        fprintf(stderr, "Failed to write %s\n", argv[2]);
+        return 1;
+    }
+    printf("Packed %d files into %s (%llu bytes)\n", int(files.size()), argv[2], static_cast<unsigned long long>(offset));
+    return 0;
+}